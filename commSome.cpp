@@ -7,6 +7,49 @@
 //------------------------------------------------------------------------------
 #include <GLFW/glfw3.h>
 //------------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <vector>
+#include <sys/stat.h>
+#if defined(COMMSOME_LOG_CODEC_ZSTD) && defined(COMMSOME_LOG_CODEC_LZ4)
+#error "define at most one of COMMSOME_LOG_CODEC_ZSTD and COMMSOME_LOG_CODEC_LZ4"
+#elif defined(COMMSOME_LOG_CODEC_ZSTD)
+#include <zstd.h>
+#elif defined(COMMSOME_LOG_CODEC_LZ4)
+#include <lz4.h>
+#endif
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+// define COMMSOME_CHECK_REALTIME to report the allocations, lock acquisitions and waits
+// of the haptic loop (Linux only; link with -rdynamic for symbol names)
+#if defined(COMMSOME_CHECK_REALTIME) && defined(__linux__)
+#define REALTIME_CHECK
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <semaphore.h>
+#endif
+//------------------------------------------------------------------------------
+#include "commSomeArena.h"
+#include "commSomeSceneState.h"
+#include "commSomeTelemetry.h"
+//------------------------------------------------------------------------------
 using namespace chai3d;
 using namespace std;
 //------------------------------------------------------------------------------
@@ -21,6 +64,8 @@ using namespace std;
     C_STEREO_ACTIVE:              Active stereo for OpenGL NVDIA QUADRO cards
     C_STEREO_PASSIVE_LEFT_RIGHT:  Passive stereo where L/R images are rendered next to each other
     C_STEREO_PASSIVE_TOP_BOTTOM:  Passive stereo where L/R images are rendered above each other
+
+    The mode can also be selected with the --stereo command line option.
 */
 cStereoMode stereoMode = C_STEREO_DISABLED;
 
@@ -30,6 +75,60 @@ bool fullscreen = false;
 // mirrored display
 bool mirroredDisplay = false;
 
+// offscreen mode (render into a framebuffer object instead of a visible window)
+bool offscreen = false;
+
+// size of the offscreen framebuffer
+int offscreenW = 1280;
+int offscreenH = 720;
+
+// largest accepted size of the offscreen framebuffer, in each dimension
+const int MAX_OFFSCREEN_SIZE = 16384;
+
+// number of frames to capture to disk (0 = capture disabled)
+int captureFrames = 0;
+
+// number of frames to render before exiting (0 = run until closed)
+int maxFrames = 0;
+
+// OpenGL 3.3 rendering backend (spheres are drawn by shaders in one instanced pass)
+bool modernRenderer = false;
+
+// single-pass stereo (with the OpenGL 3.3 backend, passive stereo modes draw both
+// eyes in one traversal of the world instead of rendering the world twice); it is
+// disabled with --two-pass-stereo and switched while running with [s]
+bool singlePassStereo = true;
+
+// publish per-tick haptic telemetry in shared memory (see commSomeTelemetry.h)
+bool telemetryEnabled = false;
+
+// local port of the Prometheus metrics endpoint (0 = disabled)
+int metricsPort = 0;
+
+// session log file written by the haptic thread (empty = disabled)
+string logFile;
+
+// local UDP port of the teleoperation channel (0 = disabled)
+int teleopPort = 0;
+
+// address (host:port) of the remote station
+string teleopPeer;
+
+// delay [s] added by the jitter buffer before a remote sample is played out
+double teleopJitterDelay = 0.020;
+
+// wave impedance [N.s/m] of the coupling between the local and remote tools
+double teleopImpedance = 4.0;
+
+// artificial delay [s] added to outgoing packets, to test the coupling under latency
+double teleopDelay = 0.0;
+
+// publish the scene state in shared memory for viewer processes (see commSomeSceneState.h)
+bool shareState = false;
+
+// run as a read-only viewer of the scene state published by another process
+bool viewerMode = false;
+
 
 //------------------------------------------------------------------------------
 // DECLARED VARIABLES
@@ -56,11 +155,581 @@ cGenericHapticDevicePtr hapticDevice;
 // a virtual tool representing the haptic device in the scene
 cToolCursor* tool;
 
-// a few spherical objects
-cShapeSphere* object0;
-cShapeSphere* object1;
-cShapeSphere* object2;
-cShapeSphere* object3;
+// custom haptic behaviors of scene objects, evaluated by the haptic thread
+enum SceneBehavior
+{
+    BEHAVIOR_NONE,
+    BEHAVIOR_DAMPING,
+    BEHAVIOR_OSCILLATOR,
+    BEHAVIOR_DYNAMIC
+};
+
+// stock haptic effects of scene objects
+enum SceneEffect
+{
+    EFFECT_SURFACE      = 0x01,
+    EFFECT_MAGNETIC     = 0x02,
+    EFFECT_VISCOSITY    = 0x04,
+    EFFECT_STICK_SLIP   = 0x08,
+    EFFECT_VIBRATION    = 0x10
+};
+
+// flags of scene objects
+enum SceneFlag
+{
+    FLAG_IN_WORLD           = 0x01,
+    FLAG_USE_TEXTURE        = 0x02,
+    FLAG_SPHERICAL_MAPPING  = 0x04,
+    FLAG_ABSOLUTE_STIFFNESS = 0x08
+};
+
+// material properties given by a scene object; the others keep the values of the material
+enum SceneMaterialParam
+{
+    PARAM_STIFFNESS             = 0x01,
+    PARAM_VISCOSITY             = 0x02,
+    PARAM_MAGNET_MAX_FORCE      = 0x04,
+    PARAM_MAGNET_MAX_DISTANCE   = 0x08,
+    PARAM_STICK_SLIP_FORCE_MAX  = 0x10,
+    PARAM_STICK_SLIP_STIFFNESS  = 0x20,
+    PARAM_VIBRATION_FREQUENCY   = 0x40,
+    PARAM_VIBRATION_AMPLITUDE   = 0x80
+};
+
+// description of a scene object; this is also the record of binary scene files,
+// so it only contains fixed-size fields. Stiffness, viscosity and force values
+// are fractions of the maximum values of the haptic device.
+struct SceneObjectDesc
+{
+    char name[16];
+    char texture[48];
+    float position[3];
+    float radius;
+    uint32_t flags;
+    uint32_t effects;
+    uint32_t behavior;
+
+    // material properties
+    float stiffness;
+    float viscosity;
+    float magnetMaxForce;
+    float magnetMaxDistance;
+    float stickSlipForceMax;
+    float stickSlipStiffness;
+    float vibrationFrequency;
+    float vibrationAmplitude;
+    uint32_t specified; // material properties given by the scene (SceneMaterialParam)
+
+    // custom behavior parameters
+    float margin;       // added to the radius to detect contact [m]
+    float gain;         // gain applied to the tool force while in contact
+    float damping;      // damping coefficient [N.s/m]
+    float frequency;    // oscillation frequency [Hz]
+    float amplitude;    // oscillation amplitude [N]
+    float mass;         // mass of a dynamic object [kg]
+    float range;        // distance after which a dynamic object is reset [m]
+
+    // vibrotactile pattern of an oscillator (empty = Lissajous at the oscillation frequency)
+    char pattern[96];
+    float patternLoop;  // loop length [s] (0 = whole periods of the slowest carrier)
+
+    // haptic texture, sampled at the spherical coordinates of the contact point
+    char heightMap[32];     // height map image, or bumps, grooves or rough
+    char frictionMap[32];   // friction map image or procedural map (empty = uniform)
+    float bumpDepth;        // height of the white level of the height map [m]
+    float friction;         // kinetic friction coefficient of the white level of the friction map
+};
+
+// keys of a scene object whose value is a number
+const string numericSceneKeys[] = { "radius", "stiffness", "stiffnessabs", "viscosity", "magnetforce", "magnetdistance",
+                                    "stickslipforce", "stickslipstiffness", "vibrationfreq", "vibrationamp", "margin",
+                                    "gain", "damping", "frequency", "amplitude", "mass", "range", "patternloop",
+                                    "bumpdepth", "friction" };
+const int NUM_NUMERIC_SCENE_KEYS = sizeof(numericSceneKeys) / sizeof(numericSceneKeys[0]);
+
+// version of the binary scene file format
+const uint32_t SCENE_FILE_VERSION = 4;
+
+// header of a binary scene file
+struct SceneFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t recordSize;
+};
+
+// a texel of a haptic texture
+struct HapticTexel
+{
+    float height;       // height [0..1]
+    float slopeU;       // derivative of the height along the longitude, per unit of u
+    float slopeV;       // derivative of the height along the latitude, per unit of v
+    float friction;     // friction scale [0..1]
+};
+
+// a haptic texture and its mipmaps; level 0 has the full resolution and each
+// level halves it, so that features smaller than the tool can be filtered out
+struct HapticTexture
+{
+    vector<vector<HapticTexel> > levels;
+    vector<int> widths;
+    vector<int> heights;
+};
+
+// a scene object and the runtime state of its custom behavior
+struct SceneObject
+{
+    SceneObjectDesc desc;
+    int id;                     // index of the object in the scene and in the transform table
+    cShapeSphere* shape;        // node used for haptic rendering
+    cShapeSphere* display;      // node drawn by the graphic thread
+    int poseIndex;              // index in the pose samples (-1 = not moving)
+    cVector3d startPos;
+    cVector3d velocity;
+    double time;
+    bool inside;
+
+    // force pattern of an oscillator, one 3D sample per haptic tick
+    shared_ptr<vector<float> > waveformTable;   // table compiled when the scene is built
+    const float* waveform;                      // table in use (built or reloaded)
+    int waveformLength;                         // number of samples in the table
+
+    // haptic texture; the mipmap level matching the tool size is selected when the scene is built
+    shared_ptr<HapticTexture> hapticTexture;
+    const HapticTexel* texels;
+    int texelWidth;
+    int texelHeight;
+};
+
+// state shared by the stages of a fused effect during one evaluation
+struct EffectContext
+{
+    cVector3d toolPos;
+    cVector3d toolVel;
+    bool inside;                // contact state computed once by the parent object
+    cVector3d toSurface;        // from the tool to the nearest surface point
+    cMaterial* material;
+    cVector3d force;
+};
+
+// the vibration, viscosity, magnetic and stick-slip effects of an object, evaluated
+// in a single pass that shares the contact state, the direction to the surface and
+// the material parameters; this runtime version selects its stages with flags
+class FusedEffect : public cGenericEffect
+{
+public:
+    FusedEffect(cGenericObject* a_parent, uint32_t a_effects);
+    virtual bool computeForce(const cVector3d& a_toolPos, const cVector3d& a_toolVel,
+                              const unsigned int& a_toolID, cVector3d& a_reactionForce);
+
+    // fused effects are allocated in the arena of their object
+    static void* operator new(size_t a_size, SceneArena& a_arena) { return (a_arena.allocate(a_size)); }
+    static void operator delete(void*, SceneArena&) {}
+    static void operator delete(void*) {}
+
+    // effects evaluated by this effect (EFFECT_* flags)
+    uint32_t m_effects;
+
+    // clock of the vibration
+    cPrecisionClock m_clock;
+
+    // anchor of the stick-slip effect while the tool is inside
+    cVector3d m_stickPos;
+    bool m_sticking;
+
+protected:
+    // this function fills the context shared by the stages
+    void beginEvaluation(const cVector3d& a_toolPos, const cVector3d& a_toolVel, EffectContext& a_context);
+};
+
+// stages of fused effects; each adds its force to the context
+struct VibrationStage
+{
+    static const uint32_t FLAG = EFFECT_VIBRATION;
+    static void apply(EffectContext& a_context, FusedEffect& a_effect)
+    {
+        if (!a_context.inside) { return; }
+        double phase = 2.0 * C_PI * a_context.material->getVibrationFrequency() * a_effect.m_clock.getCurrentTimeSeconds();
+        a_context.force(0) += a_context.material->getVibrationAmplitude() * sin(phase);
+    }
+};
+
+struct ViscosityStage
+{
+    static const uint32_t FLAG = EFFECT_VISCOSITY;
+    static void apply(EffectContext& a_context, FusedEffect& a_effect)
+    {
+        if (!a_context.inside) { return; }
+        a_context.force -= a_context.material->getViscosity() * a_context.toolVel;
+    }
+};
+
+// a spring to an anchor that slides once the force limit is reached
+struct StickSlipStage
+{
+    static const uint32_t FLAG = EFFECT_STICK_SLIP;
+    static void apply(EffectContext& a_context, FusedEffect& a_effect)
+    {
+        if (!a_context.inside)
+        {
+            a_effect.m_sticking = false;
+            return;
+        }
+        double stiffness = a_context.material->getStickSlipStiffness();
+        double forceMax = a_context.material->getStickSlipForceMax();
+        if (!a_effect.m_sticking)
+        {
+            a_effect.m_stickPos = a_context.toolPos;
+            a_effect.m_sticking = true;
+        }
+        cVector3d stretch = a_effect.m_stickPos - a_context.toolPos;
+        double length = stretch.length();
+        if ((stiffness > 0.0) && (stiffness * length > forceMax))
+        {
+            a_effect.m_stickPos = a_context.toolPos + (forceMax / (stiffness * length)) * stretch;
+            stretch = a_effect.m_stickPos - a_context.toolPos;
+        }
+        a_context.force += stiffness * stretch;
+    }
+};
+
+// attraction towards the surface, linear up to the maximum force, then
+// decreasing to zero at the maximum distance
+struct MagnetStage
+{
+    static const uint32_t FLAG = EFFECT_MAGNETIC;
+    static void apply(EffectContext& a_context, FusedEffect& a_effect)
+    {
+        double distance = a_context.toSurface.length();
+        double maxForce = a_context.material->getMagnetMaxForce();
+        double maxDistance = a_context.material->getMagnetMaxDistance();
+        double stiffness = a_context.material->getStiffness();
+        if ((distance <= 0.0) || (distance >= maxDistance) || (stiffness <= 0.0)) { return; }
+
+        // a spring up to the maximum force, then a linear decay to zero at the
+        // maximum distance, as in cEffectMagnet
+        double linearLimit = maxForce / stiffness;
+        double magnitude = 0.0;
+        if (distance < linearLimit)
+        {
+            magnitude = stiffness * distance;
+        }
+        else if (maxDistance - linearLimit > 0.0)
+        {
+            magnitude = maxForce * (maxDistance - distance) / (maxDistance - linearLimit);
+        }
+        a_context.force += (magnitude / distance) * a_context.toSurface;
+    }
+};
+
+// a compile-time list of stages
+template <class... Stages> struct StageList {};
+
+// a fused effect whose stages are fixed at compile time, so that the whole
+// evaluation is inlined without flag tests or virtual calls between stages
+template <class List> class FusedEffectKernel;
+
+template <class... Stages>
+class FusedEffectKernel<StageList<Stages...> > : public FusedEffect
+{
+public:
+    FusedEffectKernel(cGenericObject* a_parent) : FusedEffect(a_parent, (Stages::FLAG | ... | 0u)) {}
+
+    virtual bool computeForce(const cVector3d& a_toolPos, const cVector3d& a_toolVel,
+                              const unsigned int& a_toolID, cVector3d& a_reactionForce)
+    {
+        EffectContext context;
+        beginEvaluation(a_toolPos, a_toolVel, context);
+        (Stages::apply(context, *this), ...);
+        a_reactionForce = context.force;
+        return (context.inside || (context.force.lengthsq() > 0.0));
+    }
+};
+
+// appends a stage to a list when a condition holds
+template <bool Condition, class Stage, class List> struct AppendStageIf { typedef List type; };
+
+template <class Stage, class... Stages>
+struct AppendStageIf<true, Stage, StageList<Stages...> > { typedef StageList<Stages..., Stage> type; };
+
+// the stages of a combination of effects; bit 0 is the vibration, bit 1 the viscosity,
+// bit 2 the stick-slip and bit 3 the magnet, in evaluation order
+template <int Combination>
+struct StagesOf
+{
+    typedef typename AppendStageIf<(Combination & 1) != 0, VibrationStage, StageList<> >::type List0;
+    typedef typename AppendStageIf<(Combination & 2) != 0, ViscosityStage, List0>::type List1;
+    typedef typename AppendStageIf<(Combination & 4) != 0, StickSlipStage, List1>::type List2;
+    typedef typename AppendStageIf<(Combination & 8) != 0, MagnetStage, List2>::type type;
+};
+
+// number of combinations of fused effects
+const int NUM_EFFECT_COMBINATIONS = 16;
+
+// time step [s] of the haptic simulation
+const double HAPTIC_TIME_STEP = 0.001;
+
+// carrier shapes of a synthesizer voice
+enum WaveShape
+{
+    WAVE_SINE,
+    WAVE_SQUARE,
+    WAVE_SAW,
+    WAVE_TRIANGLE
+};
+
+// a voice of a vibrotactile pattern
+struct WaveVoice
+{
+    int shape;
+    double frequency;       // carrier frequency [Hz]
+    double amplitude;       // gain relative to the object amplitude
+    double phase;           // carrier phase [deg]
+    cVector3d direction;    // direction of the force
+    double amDepth;         // amplitude modulation depth [0..1]
+    double amRate;          // amplitude modulation rate [Hz]
+    double fmDeviation;     // frequency modulation deviation [Hz]
+    double fmRate;          // frequency modulation rate [Hz]
+    double attack;          // envelope attack time [s]
+    double decay;           // envelope decay time [s]
+    double sustain;         // envelope sustain level [0..1]
+    double release;         // envelope release time [s]
+    double start;           // start of the voice in the loop [s]
+    double duration;        // duration of the voice [s] (0 = until the end of the loop)
+};
+
+// maximum loop length [s] of a compiled pattern
+const double MAX_WAVEFORM_LOOP = 10.0;
+
+// maximum number of dynamic objects whose poses are interpolated
+const int MAX_DYNAMIC_OBJECTS = 8;
+
+// scene file (empty = built-in scene)
+string sceneFile;
+
+// objects of the scene
+vector<SceneObject> sceneObjects;
+
+// storage of the nodes, materials and effects used by the haptic thread; the
+// nodes, material and effects of an object are allocated consecutively
+SceneArena hapticArena;
+
+// storage of the nodes that are only displayed
+SceneArena displayArena;
+
+// global positions and bounding spheres of the scene objects, as parallel arrays
+// indexed by object id. The haptic thread reads and moves objects through this
+// table only, and copies the positions of moved objects to their nodes once per
+// tick; scene objects are spheres attached to the world, so their global frame
+// is their local position.
+struct TransformTable
+{
+    vector<double> x;
+    vector<double> y;
+    vector<double> z;
+    vector<double> radius;      // radius of the bounding sphere [m]
+    vector<uint8_t> moved;      // set when the node must be updated from the table
+    vector<int> movedIds;       // ids of the moved objects, in the order they moved
+
+    // position of an object
+    inline cVector3d getPos(int a_id) const { return (cVector3d(x[a_id], y[a_id], z[a_id])); }
+
+    // move an object; its node is updated by the next call to syncTransforms()
+    inline void setPos(int a_id, const cVector3d& a_pos)
+    {
+        x[a_id] = a_pos(0);
+        y[a_id] = a_pos(1);
+        z[a_id] = a_pos(2);
+        if (!moved[a_id])
+        {
+            moved[a_id] = 1;
+            movedIds.push_back(a_id);
+        }
+    }
+};
+
+// transform table of the scene objects, owned by the haptic thread once it runs
+TransformTable transforms;
+
+#ifdef REALTIME_CHECK
+// a flag set while the current thread runs a haptic tick
+thread_local bool realtimeSection = false;
+
+// a flag set while the current thread reports a violation, whose own allocations are ignored
+thread_local bool realtimeReporting = false;
+
+// number of allocations, lock acquisitions and waits during haptic ticks
+atomic<unsigned int> realtimeViolations(0);
+
+// hashes of the call stacks already reported; each call stack is reported once
+const int MAX_REALTIME_SITES = 256;
+atomic<uint64_t> realtimeSites[MAX_REALTIME_SITES];
+
+#endif
+
+// objects of the scene that have a custom haptic behavior
+vector<SceneObject*> behaviorObjects;
+
+// objects of the scene that have a haptic texture
+vector<SceneObject*> texturedObjects;
+
+// number of dynamic objects in the scene
+int numDynamicObjects = 0;
+
+// a flag to create the stock CHAI3D effects instead of fused effects
+bool stockEffects = false;
+
+// a flag to create runtime fused effects instead of compile-time kernels
+bool runtimeEffects = false;
+
+// maximum values of the haptic device, used to scale scene parameters
+double deviceMaxLinearForce = 0.0;
+double deviceMaxStiffness = 0.0;
+double deviceMaxDamping = 0.0;
+
+// a sample of the viscosity field
+struct FieldSample
+{
+    float viscosity;    // viscosity [N.s/m]
+    float current[3];   // velocity of the medium [m/s]
+};
+
+// edge length of a brick of the viscosity field, in cells
+const int FIELD_BRICK = 4;
+
+// samples stored per brick; bricks include the samples shared with their neighbors,
+// so that the 8 samples around any point are read from a single brick
+const int FIELD_BRICK_SAMPLES = (FIELD_BRICK + 1) * (FIELD_BRICK + 1) * (FIELD_BRICK + 1);
+
+// a sparse voxel grid of viscosity and current; empty bricks all refer to brick 0,
+// which holds zeros, so that sampling does not branch on empty space
+struct VoxelField
+{
+    cVector3d origin;           // position of the first sample [m]
+    double invVoxelSize;        // inverse of the distance between samples [1/m]
+    int size[3];                // number of samples along each axis
+    int bricks[3];              // number of bricks along each axis
+    vector<int32_t> brickIndex; // first sample of each brick
+    vector<FieldSample> samples;
+};
+
+// viscosity field file (empty = no field)
+string fieldFile;
+
+// viscosity field applied to the tool
+VoxelField viscosityField;
+
+// haptic parameters of a scene object that can be reloaded while running
+struct HapticParams
+{
+    // custom behavior parameters
+    float margin;
+    float gain;
+    float damping;
+    float frequency;
+    float amplitude;
+    float mass;
+    float range;
+
+    // force pattern of an oscillator, compiled by the watcher thread
+    shared_ptr<vector<float> > waveform;
+
+    // haptic texture gains; the maps themselves are not reloaded
+    float bumpDepth;
+    float friction;
+
+    // material properties, scaled to the haptic device, and those given by the scene
+    uint32_t specified;
+    double stiffness;
+    double viscosity;
+    double magnetMaxForce;
+    double magnetMaxDistance;
+    double stickSlipForceMax;
+    double stickSlipStiffness;
+    double vibrationFrequency;
+    double vibrationAmplitude;
+};
+
+// triple buffer of reloaded parameters, one entry per scene object; the watcher
+// thread fills the back buffer, the haptic thread reads the front buffer, and
+// they swap buffers through an atomic index without ever waiting for each other
+vector<HapticParams> paramBuffers[3];
+
+// index of the buffer shared by both threads; PARAMS_NEW is set when it holds new parameters
+atomic<int> paramShared(0);
+const int PARAMS_NEW = 4;
+
+// index of the buffer owned by the watcher thread
+int paramBack = 1;
+
+// index of the buffer owned by the haptic thread
+int paramFront = 2;
+
+// latest descriptions of the scene objects, owned by the watcher thread
+vector<SceneObjectDesc> reloadedDescs;
+
+// a flag that indicates if the parameter watcher thread is currently running
+bool watcherRunning = false;
+
+// a flag that indicates if the parameter watcher thread has terminated
+bool watcherFinished = true;
+
+// parameter watcher thread
+cThread* watcherThread = nullptr;
+
+// a texture image to be decoded by a worker thread and installed by the render thread
+struct TextureJob
+{
+    string path;
+    cTexture2dPtr texture;
+    cImagePtr image;
+};
+
+// textures shared by all objects that use the same image
+map<string, cTexture2dPtr> textureCache;
+
+// haptic textures shared by all objects that use the same maps
+map<string, shared_ptr<HapticTexture> > hapticTextureCache;
+
+// resolution of procedural haptic textures
+const int PROCEDURAL_TEXTURE_WIDTH = 512;
+const int PROCEDURAL_TEXTURE_HEIGHT = 256;
+
+// images waiting to be decoded
+deque<TextureJob> textureJobs;
+
+// decoded images waiting to be installed by the render thread
+deque<TextureJob> decodedTextures;
+
+// a mutex to protect the texture queues
+cMutex textureMutex;
+
+// number of texture loading threads
+const int NUM_TEXTURE_WORKERS = 2;
+
+// number of texture loading threads still running
+atomic<int> textureWorkersActive(0);
+
+// texture loading threads
+vector<cThread*> textureWorkers;
+
+// the built-in scene
+const char* defaultScene =
+    "# sphere <name> [key=value]... [flag]...\n"
+    "# stiffness, viscosity and force values are fractions of the device maximum;\n"
+    "# custom behaviors are evaluated in the order of the file\n"
+    "# pattern=<voice>|<voice>... replaces the Lissajous force of an oscillator; a voice is\n"
+    "#   <sin|sqr|saw|tri>:f<Hz>:a<gain>:p<deg>:d<x,y,z>:am<depth>@<Hz>:fm<Hz>@<Hz>:e<A,D,S,R>:t<start,length>\n"
+    "# patternloop=<s> sets the loop length of the pattern\n"
+    "# heightmap=<image|bumps|grooves|rough> bumpdepth=<m> frictionmap=<image|...> friction=<coefficient>\n"
+    "#   add a haptic texture, mapped by longitude and latitude\n"
+    "sphere object0 radius=0.5 pos=0,-1.2,0 texture=spheremap-3.jpg effects=surface behavior=damping margin=0.05 damping=0.1 gain=4\n"
+    "sphere object1 radius=0.3 pos=0,0,0 hidden usetexture texture=spheremap-2.jpg viscosity=0.9 effects=viscosity\n"
+    "sphere object3 radius=0.5 pos=0,0,0 usetexture vibrationfreq=60 vibrationamp=0.5 stiffnessabs=0.1 "
+        "effects=vibration,surface,viscosity behavior=oscillator margin=0.05 frequency=6 amplitude=6\n"
+    "sphere object2 radius=0.3 pos=0,1,0 usetexture texture=spheremap-5.jpg stickslipforce=0.2 stickslipstiffness=0.6 "
+        "effects=stickslip behavior=dynamic margin=0.03 mass=0.5 damping=0 gain=10 range=1\n";
 
 // a font for rendering text
 cFontPtr font;
@@ -83,6 +752,162 @@ cFrequencyCounter freqCounterHaptics;
 // haptic thread
 cThread* hapticsThread;
 
+// a clock shared by the haptic and graphic threads to timestamp poses
+cPrecisionClock simClock;
+
+// a ring buffer in shared memory where the haptic thread publishes telemetry
+TelemetryWriter telemetry;
+
+// the scene state published for viewer processes (server side)
+SceneStateWriter sceneStateWriter;
+
+// the scene state published by the server (viewer side)
+SceneStateReader sceneStateReader;
+
+// poses of the moving objects at one haptic tick
+struct PoseData
+{
+    double time;
+    cVector3d toolPos;
+    cVector3d objectPos[MAX_DYNAMIC_OBJECTS];
+    cVector3d remoteToolPos;
+    bool remoteToolActive;
+};
+
+// a pose sample slot, protected by a sequence counter (odd while being written)
+struct PoseSlot
+{
+    atomic<unsigned int> sequence;
+    PoseData data;
+};
+
+// number of pose samples kept in the pose history
+const int POSE_HISTORY = 64;
+
+// timestamped poses published by the haptic thread
+PoseSlot poseHistory[POSE_HISTORY];
+
+// number of pose samples published so far
+atomic<unsigned int> poseHistoryCount(0);
+
+// a viewer walks the shared pose table like the local pose history
+static_assert((SCENE_STATE_POSES == POSE_HISTORY) && (SCENE_STATE_MAX_OBJECTS == MAX_DYNAMIC_OBJECTS),
+              "the shared pose table must match the pose history");
+
+// minimum latency [s] of the displayed poses behind the latest haptic sample
+double minPoseLatency = 0.002;
+
+// display copy of the tool, posed by the graphic thread
+cShapeSphere* toolDisplay;
+
+// a scene graph node that draws spheres with OpenGL 3.3 shaders; all spheres are
+// drawn from one shared mesh with instancing, materials are passed as instance
+// attributes and the light in a uniform buffer, and spherical texture mapping is
+// computed per fragment
+class cSphereBatch : public cGenericObject
+{
+public:
+    cSphereBatch();
+    virtual ~cSphereBatch();
+
+    // add a sphere to the batch; it is removed from the fixed-function path
+    void addSphere(cShapeSphere* a_sphere);
+
+    // render all spheres of the batch
+    virtual void render(cRenderOptions& a_options);
+
+    // set the passive stereo mode drawn in a single pass (C_STEREO_DISABLED for mono)
+    void setStereoMode(cStereoMode a_stereoMode) { m_stereoMode = a_stereoMode; }
+
+protected:
+    // create shaders and buffers
+    bool initialize();
+
+    // get the OpenGL texture holding the image of a texture
+    GLuint getTexture(cTexture2dPtr a_texture);
+
+    // spheres drawn by the batch
+    vector<cShapeSphere*> m_spheres;
+
+    // texture of each sphere, and whether it is shown, when the instance order was built
+    vector<GLuint> m_sphereTextures;
+    vector<bool> m_sphereShown;
+
+    // indices of the shown spheres sorted by texture, and the size of each texture group
+    vector<int> m_order;
+    vector<pair<GLuint, GLsizei> > m_groups;
+
+    // OpenGL textures created for each texture, with the image they were created from
+    map<cTexture2d*, pair<cImage*, GLuint> > m_textures;
+
+    // per-instance data (center, radius, ambient, diffuse, specular and shininess, texture flag)
+    vector<float> m_instanceData;
+
+    // OpenGL objects
+    GLuint m_program;
+    GLuint m_vertexArray;
+    GLuint m_vertexBuffer;
+    GLuint m_indexBuffer;
+    GLuint m_instanceBuffer;
+    GLuint m_frameBuffer;
+    GLsizei m_indexCount;
+
+    // passive stereo mode drawn in a single pass
+    cStereoMode m_stereoMode;
+
+    // initialization state
+    bool m_initialized;
+    bool m_failed;
+};
+
+// per-frame uniform block of a sphere batch (std140 layout)
+struct BatchFrameUniforms
+{
+    float viewProjection[2][16];
+    float view[2][16];
+    float eyePosition[2][4];
+    float lightPosition[4];
+    float lightDirection[4];
+    float lightAmbient[4];
+    float lightDiffuse[4];
+    float lightSpecular[4];
+    int stereo[4];
+};
+
+// number of floats of the per-instance data of a sphere batch
+const int BATCH_INSTANCE_FLOATS = 17;
+
+// spheres drawn by the OpenGL 3.3 rendering backend
+cSphereBatch* sphereBatch = nullptr;
+
+// a front layer node that draws its widgets once per eye; in single-pass stereo the
+// camera renders in mono, and the widgets would otherwise span both halves of the display
+class cStereoOverlay : public cGenericObject
+{
+public:
+    cStereoOverlay() : m_stereoMode(C_STEREO_DISABLED) { m_widgets = new cWorld(); }
+    virtual ~cStereoOverlay() { delete m_widgets; }
+
+    // render the widgets in the current viewport, or in each half of it
+    virtual void render(cRenderOptions& a_options);
+
+    // set the passive stereo mode drawn in a single pass (C_STEREO_DISABLED for mono)
+    void setStereoMode(cStereoMode a_stereoMode) { m_stereoMode = a_stereoMode; }
+
+    // get the passive stereo mode drawn in a single pass
+    cStereoMode getStereoMode() const { return (m_stereoMode); }
+
+    // widgets drawn by the overlay, positioned in the view of one eye
+    cWorld* m_widgets;
+
+protected:
+    // passive stereo mode drawn in a single pass
+    cStereoMode m_stereoMode;
+};
+
+// widgets of the front layer
+cStereoOverlay* stereoOverlay = nullptr;
+
 // a handle to window display context
 GLFWwindow* window = nullptr;
 
@@ -94,737 +919,6113 @@ int windowH = 0;
 int framebufferW = 0;
 int framebufferH = 0;
 
-// swap interval for the display context (vertical synchronization)
-int swapInterval = 1;
+// display state produced by the event thread and consumed by the render thread
+struct DisplayState
+{
+    int framebufferW;
+    int framebufferH;
+    float contentScaleW;
+    float contentScaleH;
+    bool mirroredDisplay;
+    bool singlePassStereo;
+    bool profilerEnabled;
+    bool profilerExport;
+    bool swapIntervalChanged;
+};
 
+// latest display state published by the event thread
+DisplayState displayState;
 
-//------------------------------------------------------------------------------
-// DECLARED FUNCTIONS
-//------------------------------------------------------------------------------
+// a mutex to protect the display state
+cMutex displayStateMutex;
 
-// callback when the window is resized
-void onWindowSizeCallback(GLFWwindow* a_window, int a_width, int a_height);
+// a flag that indicates if the graphics rendering thread is currently running
+bool graphicsRunning = false;
 
-// callback when the window framebuffer is resized
-void onFrameBufferSizeCallback(GLFWwindow* a_window, int a_width, int a_height);
+// a flag that indicates if the graphics rendering thread has terminated
+bool graphicsFinished = true;
 
-// callback when an error GLFW occurs
-void onErrorCallback(int a_error, const char* a_description);
+// graphics rendering thread
+cThread* graphicsThread;
 
-// callback when a key is pressed
-void onKeyCallback(GLFWwindow* a_window, int a_key, int a_scancode, int a_action, int a_mods);
+// swap interval for the display context (vertical synchronization)
+int swapInterval = 1;
 
-// callback when window content scaling is modified
-void onWindowContentScaleCallback(GLFWwindow* a_window, float a_xscale, float a_yscale);
+// offscreen framebuffer object and its color and depth attachments
+GLuint offscreenFbo = 0;
+GLuint offscreenColorBuffer = 0;
+GLuint offscreenDepthBuffer = 0;
 
-// this function renders the scene
-void renderGraphics(void);
+// number of pixel buffers used to read back frames asynchronously
+const int NUM_READBACK_BUFFERS = 3;
 
-// this function contains the main haptics simulation loop
-void renderHaptics(void);
+// pixel buffers used to read back frames asynchronously
+GLuint readbackBuffers[NUM_READBACK_BUFFERS] = { 0 };
 
-// this function closes the application
-void close(void);
+// frame index pending in each pixel buffer (-1 = empty)
+int readbackFrames[NUM_READBACK_BUFFERS] = { -1, -1, -1 };
 
+// next pixel buffer to be used for a readback
+int readbackHead = 0;
 
-//==============================================================================
+// number of frames queued for capture so far
+int captureCount = 0;
 
-//==============================================================================
+// maximum number of captured frames waiting to be written to disk
+const int MAX_PENDING_CAPTURES = 16;
 
-int main(int argc, char* argv[])
+// a frame read back from the offscreen framebuffer
+struct CapturedFrame
 {
-    //--------------------------------------------------------------------------
-    // INITIALIZATION
-    //--------------------------------------------------------------------------
+    int index;
+    cImagePtr image;
+};
 
-    cout << endl;
-    cout << "-----------------------------------" << endl;
-    cout << "CHAI3D" << endl;
-    cout << "Demo: 11-effects" << endl;
-    cout << "Copyright 2003-2024" << endl;
-    cout << "-----------------------------------" << endl << endl << endl;
-    cout << "Keyboard Options:" << endl << endl;
-    cout << "[f] - Enable/Disable full screen mode" << endl;
-    cout << "[m] - Enable/Disable vertical mirroring" << endl;
-    cout << "[q] - Exit application" << endl;
-    cout << endl << endl;
+// captured frames waiting to be written to disk
+deque<CapturedFrame> captureQueue;
 
+// a mutex to protect the capture queue
+cMutex captureMutex;
 
-    //--------------------------------------------------------------------------
-    // OPEN GL - WINDOW DISPLAY
-    //--------------------------------------------------------------------------
+// a flag that indicates if the capture writer thread is running
+bool captureRunning = false;
 
-    // initialize GLFW library
-    if (!glfwInit())
-    {
-        cout << "failed initialization" << endl;
-        cSleepMs(1000);
-        return 1;
-    }
+// a flag that indicates if the capture writer thread has terminated
+bool captureFinished = true;
 
-    // set GLFW error callback
-    glfwSetErrorCallback(onErrorCallback);
+// number of captured frames dropped because the writer could not keep up
+int captureDropped = 0;
 
-    // compute desired size of window
-    const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
-    windowW = 0.8 * mode->height;
-    windowH = 0.5 * mode->height;
-    int x = 0.5 * (mode->width - windowW);
-    int y = 0.5 * (mode->height - windowH);
+// capture writer thread
+cThread* captureThread = nullptr;
 
-    // set OpenGL version
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+// points in the frame at which the GPU profiler records a timestamp
+enum ProfilerMark
+{
+    MARK_FRAME_BEGIN,
+    MARK_SHADOWS_END,
+    MARK_OPAQUE_BEGIN,
+    MARK_TRANSPARENT_BEGIN,
+    MARK_FRONT_LAYER_BEGIN,
+    MARK_RENDER_END,
+    MARK_SWAP_END,
+    NUM_PROFILER_MARKS
+};
+
+// render passes reported by the GPU profiler
+enum ProfilerPass
+{
+    PASS_SHADOWS,
+    PASS_OPAQUE,
+    PASS_TRANSPARENT,
+    PASS_FRONT_LAYER,
+    PASS_SWAP,
+    NUM_PROFILER_PASSES
+};
 
-    // enable double buffering
-    glfwWindowHint(GLFW_DOUBLEBUFFER, GLFW_TRUE);
+// names of the render passes reported by the GPU profiler
+const char* profilerPassNames[NUM_PROFILER_PASSES] = { "shadows", "opaque", "transparent", "front layer", "swap" };
 
-    // set the desired number of samples to use for multisampling
-    glfwWindowHint(GLFW_SAMPLES, 4);
+// number of frames a timer query is given to complete before it is read back
+const int PROFILER_LATENCY = 4;
 
-    // specify that window should be resized based on monitor content scale
-    glfwWindowHint(GLFW_SCALE_TO_MONITOR, GLFW_TRUE);
+// number of frames kept in the profiler history
+const int PROFILER_HISTORY = 1024;
 
-    // set active stereo mode
-    if (stereoMode == C_STEREO_ACTIVE)
-    {
-        glfwWindowHint(GLFW_STEREO, GL_TRUE);
-    }
-    else
-    {
-        glfwWindowHint(GLFW_STEREO, GL_FALSE);
-    }
+// a flag that indicates if the GPU profiler is enabled
+bool profilerEnabled = false;
 
-    // create display context
-    window = glfwCreateWindow(windowW, windowH, "CHAI3D", NULL, NULL);
-    if (!window)
-    {
-        cout << "failed to create window" << endl;
-        cSleepMs(1000);
-        glfwTerminate();
-        return 1;
-    }
+// a flag that indicates if the display context supports timestamp queries
+bool profilerSupported = false;
 
-    // set GLFW key callback
-    glfwSetKeyCallback(window, onKeyCallback);
+// timestamp queries issued for each frame in flight
+GLuint profilerQueries[PROFILER_LATENCY][NUM_PROFILER_MARKS];
 
-    // set GLFW window size callback
-    glfwSetWindowSizeCallback(window, onWindowSizeCallback);
+// flags indicating which timestamps were issued for each frame in flight
+bool profilerIssued[PROFILER_LATENCY][NUM_PROFILER_MARKS];
 
-    // set GLFW framebuffer size callback
-    glfwSetFramebufferSizeCallback(window, onFrameBufferSizeCallback);
+// frame number of each frame in flight
+int profilerFrameIndex[PROFILER_LATENCY];
 
-    // set GLFW window content scaling callback
-    glfwSetWindowContentScaleCallback(window, onWindowContentScaleCallback);
+// number of frames started since the GPU profiler was enabled
+int profilerFrame = 0;
 
-    // get width and height of window
-    glfwGetFramebufferSize(window, &framebufferW, &framebufferH);
+// measured duration [ms] of each pass for the most recent frames
+double profilerHistory[PROFILER_HISTORY][NUM_PROFILER_PASSES];
 
-    // set position of window
-    glfwSetWindowPos(window, x, y);
+// frame number of each entry in the profiler history
+int profilerHistoryFrame[PROFILER_HISTORY];
 
-    // set window size
-    glfwSetWindowSize(window, windowW, windowH);
+// number of frames recorded in the profiler history
+int profilerHistoryCount = 0;
 
-    // set GLFW current display context
-    glfwMakeContextCurrent(window);
+// a scope to display the rolling profile of the render passes
+cScope* scopeProfiler;
 
-    // set GLFW swap interval for the current display context
-    glfwSwapInterval(swapInterval);
+// a label to display the duration of each render pass
+cLabel* labelProfiler;
 
+// a scene graph node that records a GPU timestamp when it is rendered
+class cTimestampProbe : public cGenericObject
+{
+public:
+    cTimestampProbe(bool a_frontLayer) : m_frontLayer(a_frontLayer) {}
+    virtual void render(cRenderOptions& a_options);
 
-#ifdef GLEW_VERSION
-    // initialize GLEW library
-    if (glewInit() != GLEW_OK)
-    {
-        cout << "failed to initialize GLEW library" << endl;
-        glfwTerminate();
-        return 1;
-    }
-#endif
+private:
+    bool m_frontLayer;
+};
 
+// threads recorded by the tracer
+enum TraceThread
+{
+    TRACE_MAIN,
+    TRACE_GRAPHICS,
+    TRACE_HAPTICS,
+    NUM_TRACE_THREADS
+};
 
-    //--------------------------------------------------------------------------
-    // WORLD - CAMERA - LIGHTING
-    //--------------------------------------------------------------------------
-
-    // create a new world.
-    world = new cWorld();
-
-    // set the background color of the environment
-    world->m_backgroundColor.setWhite();
-
-    // create a camera and insert it into the virtual world
-    camera = new cCamera(world);
-    world->addChild(camera);
-
-    // position and orient the camera
-    camera->set(cVector3d(3.0, 0.0, 0.0),    // camera position (eye)
-                cVector3d(0.0, 0.0, 0.0),    // lookat position (target)
-                cVector3d(0.0, 0.0, 1.0));   // direction of the (up) vector
-
-    // set the near and far clipping planes of the camera
-    // anything in front or behind these clipping planes will not be rendered
-    camera->setClippingPlanes(0.01, 10.0);
-
-    // set stereo mode
-    camera->setStereoMode(stereoMode);
+// names of the traced threads
+const char* traceThreadNames[NUM_TRACE_THREADS] = { "main", "graphics", "haptics" };
 
-    // set stereo eye separation and focal length (applies only if stereo is enabled)
-    camera->setStereoEyeSeparation(0.03);
-    camera->setStereoFocalLength(3.0);
+// a phase executed by a traced thread
+struct TraceEvent
+{
+    const char* name;
+    double begin;
+    double end;
+};
 
-    // set vertical mirrored display mode
-    camera->setMirrorVertical(mirroredDisplay);
+// number of events kept per thread (about 2 s of haptic ticks)
+const unsigned int TRACE_CAPACITY = 16384;
 
-    // enable multi-pass rendering to handle transparent objects
-    camera->setUseMultipassTransparency(true);
+// a ring of events; only the traced thread writes to it
+struct TraceBuffer
+{
+    TraceEvent events[TRACE_CAPACITY];
+    atomic<uint64_t> count;
+};
 
+// event rings of the traced threads
+TraceBuffer traceBuffers[NUM_TRACE_THREADS];
 
-    // create a light source
-    light = new cSpotLight(world);
+// file the trace is written to on exit (empty = none)
+string traceFile;
 
-    // add light to world
-    world->addChild(light);
+// upper bounds [s] of the tick duration histogram buckets
+const double metricsLatencyBounds[] = { 0.00025, 0.0005, 0.001, 0.002, 0.005, 0.01, 0.05 };
 
-    // enable light source
-    light->setEnabled(true);
+// number of tick duration histogram buckets (the last one is unbounded)
+const int NUM_LATENCY_BUCKETS = sizeof(metricsLatencyBounds) / sizeof(double) + 1;
 
-    // position the light source
-    light->setLocalPos(1, 1, 1);
+// maximum number of scene objects whose contacts are counted
+const int MAX_METRIC_OBJECTS = 32;
 
-    // define the direction of the light beam
-    light->setDir(-1, -1, -1.0);
+// number of haptic ticks between two publications of the haptic metrics
+const int METRICS_PUBLISH_TICKS = 100;
 
-    // set light cone half angle
-    light->setCutOffAngleDeg(60);
+// statistics accumulated by the haptic thread in its own memory
+struct HapticStats
+{
+    uint64_t ticks;
+    uint64_t overruns;
+    uint64_t saturations;
+    uint64_t latencyBuckets[NUM_LATENCY_BUCKETS];
+    double latencySum;
+    uint64_t contacts[MAX_METRIC_OBJECTS];
+    bool inContact[MAX_METRIC_OBJECTS];
+    bool saturated;
+};
+
+// haptic metrics read by the metrics server; the haptic thread only writes
+// them every METRICS_PUBLISH_TICKS ticks, so scrapes do not contend with the
+// cache lines of the servo loop
+struct alignas(64) HapticMetrics
+{
+    atomic<double> rate;
+    atomic<uint64_t> ticks;
+    atomic<uint64_t> overruns;
+    atomic<uint64_t> saturations;
+    atomic<uint64_t> latencyBuckets[NUM_LATENCY_BUCKETS];
+    atomic<double> latencySum;
+    atomic<uint64_t> contacts[MAX_METRIC_OBJECTS];
+};
+
+// graphic metrics read by the metrics server
+struct alignas(64) GraphicsMetrics
+{
+    atomic<double> rate;
+    atomic<uint64_t> frames;
+};
 
-    //--------------------------------------------------------------------------
-    // HAPTIC DEVICES / TOOLS
-    //--------------------------------------------------------------------------
+// metrics published by the haptic thread
+HapticMetrics hapticMetrics;
 
-    // create a haptic device handler
-    handler = new cHapticDeviceHandler();
+// metrics published by the graphic thread
+GraphicsMetrics graphicsMetrics;
 
-    // get access to the first available haptic device found
-    handler->getDevice(hapticDevice, 0);
+// names of the objects whose contacts are counted
+vector<string> metricsObjectNames;
 
-    // retrieve information about the current haptic device
-    cHapticDeviceInfo hapticDeviceInfo = hapticDevice->getSpecifications();
+// metrics server thread
+bool metricsRunning = false;
+bool metricsFinished = true;
+cThread* metricsThread = nullptr;
 
-    // create a tool (cursor) and insert into the world
-    tool = new cToolCursor(world);
-    world->addChild(tool);
+// session log format
+/*
+    A session log stores haptic samples column by column, in chunks:
+
+    file header:  "CLOG", uint32 version, uint32 codec (0 = none, 1 = LZ4,
+                  2 = zstd), uint32 number of columns, then one 32-byte name
+                  per column
+    chunk:        uint32 number of samples, then for each column: uint32
+                  encoded size, uint32 stored size, stored bytes
+
+    Each column is delta encoded, zigzag mapped and written as varints. The
+    varints are compressed with the codec when it makes them smaller (stored
+    size < encoded size), otherwise they are stored as is. Times are in
+    microseconds, positions in micrometers and forces in millinewtons.
+
+    The codec is chosen at build time: define COMMSOME_LOG_CODEC_ZSTD and link
+    with -lzstd, or define COMMSOME_LOG_CODEC_LZ4 and link with -llz4. Without
+    either, logs are written uncompressed. A build reads uncompressed logs and
+    logs written with its own codec.
+*/
 
-    // connect the haptic device to the virtual tool
-    tool->setHapticDevice(hapticDevice);
+// codecs of a session log
+enum LogCodec
+{
+    LOG_CODEC_NONE,
+    LOG_CODEC_LZ4_BLOCK,
+    LOG_CODEC_ZSTD_BLOCK
+};
+
+// names of the codecs, and the build options which enable them
+const char* const logCodecNames[] = { "none", "LZ4", "zstd" };
+const char* const logCodecOptions[] = { "", "-DCOMMSOME_LOG_CODEC_LZ4 -llz4", "-DCOMMSOME_LOG_CODEC_ZSTD -lzstd" };
+
+// codec of this build
+#if defined(COMMSOME_LOG_CODEC_ZSTD)
+const uint32_t logBuildCodec = LOG_CODEC_ZSTD_BLOCK;
+#elif defined(COMMSOME_LOG_CODEC_LZ4)
+const uint32_t logBuildCodec = LOG_CODEC_LZ4_BLOCK;
+#else
+const uint32_t logBuildCodec = LOG_CODEC_NONE;
+#endif
 
-    // define a radius for the virtual tool (sphere)
-    tool->setRadius(0.03);
-    // map the physical workspace of the haptic device to a larger virtual workspace.
-    tool->setWorkspaceRadius(1.0);
+// version of the session log format
+const uint32_t LOG_VERSION = 1;
 
-    // haptic forces are enabled only if small forces are first sent to the device;
-    // this mode avoids the force spike that occurs when the application starts when 
-    // the tool is located inside an object for instance. 
-    tool->setWaitForSmallForce(true);
+// number of samples in a chunk (about 4 s at 1 kHz)
+const int LOG_CHUNK_SAMPLES = 4096;
 
-    // start the haptic tool
-    tool->start();
+// number of chunks the haptic thread can fill ahead of the writer thread
+const int LOG_POOL = 8;
 
+// columns: time, tool position, force, contacts, dynamic object positions
+const int LOG_FIXED_COLUMNS = 8;
+const int MAX_LOG_COLUMNS = LOG_FIXED_COLUMNS + 3 * MAX_DYNAMIC_OBJECTS;
 
-    //--------------------------------------------------------------------------
-    // CREATING OBJECTS
-    //--------------------------------------------------------------------------
+// a chunk of samples, filled by the haptic thread and written by the writer thread
+struct LogChunk
+{
+    int count;
+    int64_t values[MAX_LOG_COLUMNS][LOG_CHUNK_SAMPLES];
+};
 
-    // read the scale factor between the physical workspace of the haptic
-    // device and the virtual workspace defined for the tool
-    double workspaceScaleFactor = tool->getWorkspaceScaleFactor();
+// chunks shared by the haptic and writer threads
+LogChunk* logChunks = nullptr;
 
-    // get properties of haptic device
-    double maxLinearForce = cMin(hapticDeviceInfo.m_maxLinearForce, 7.0);
-    double maxStiffness = hapticDeviceInfo.m_maxLinearStiffness / workspaceScaleFactor;
-    double maxDamping   = hapticDeviceInfo.m_maxLinearDamping / workspaceScaleFactor;
+// number of chunks completed by the haptic thread
+atomic<uint64_t> logHead(0);
 
+// number of chunks written to disk by the writer thread
+atomic<uint64_t> logTail(0);
 
-    /////////////////////////////////////////////////////////////////////////
-    // OBJECT 0: "MAGNET"
-    /////////////////////////////////////////////////////////////////////////
+// number of samples dropped because the writer thread fell behind
+atomic<uint64_t> logDropped(0);
 
-    // get current path
-    bool fileload;
-    string currentpath = cGetCurrentPath();
+// number of columns of the session log
+int logColumns = 0;
 
-    // create a sphere and define its radius
-    object0 = new cShapeSphere(0.5);
+// file of the session log
+FILE* logOutput = NULL;
 
-    // add object to world
-    world->addChild(object0);
+// session log writer thread
+bool logRunning = false;
+bool logFinished = true;
+cThread* logThread = nullptr;
 
-    // set the position of the object at the center of the world
-    object0->setLocalPos(0.0, -1.2, 0.0);
+// identifies a teleoperation packet ("TLOP")
+const uint32_t TELEOP_MAGIC = 0x504f4c54;
 
-    // load texture map
-    object0->m_texture = cTexture2d::create();
-    //fileload = object0->m_texture->loadFromFile(currentpath + "../resources/images/spheremap-3.jpg"); //metal
+// a teleoperation packet; both stations run this program on the same architecture
+struct TeleopPacket
+{
+    uint32_t magic;
+    uint32_t sequence;
+    double time;            // sender clock [s]
+    float position[3];      // tool position [m]
+    float force[3];         // tool force [N]
+    float wave[3];          // wave variable sent by the local tool
+    float returnWave[3];    // wave variable returned by the proxy of the remote tool
+};
+
+// a packet and the local time at which it was received
+struct TeleopArrival
+{
+    TeleopPacket packet;
+    double arrival;
+};
 
+// capacity of the queues between the haptic and network threads
+const uint32_t TELEOP_QUEUE = 256;
 
-    // set graphic properties
-    object0->m_texture->setSphericalMappingEnabled(true);
-    object0->m_material->setGray();
-    // set haptic properties
-    //object0->m_material->setStiffness(0.4 * maxStiffness);          // % of maximum linear stiffness
-    //object0->m_material->setMagnetMaxForce(0.8 * maxLinearForce);   // % of maximum linear force 
-    //object0->m_material->setMagnetMaxDistance(0.15);
-    //object0->m_material->setViscosity(0.1 * maxDamping);            // % of maximum linear damping
+// capacity of the jitter buffer
+const int TELEOP_JITTER = 64;
 
-    // create a haptic surface effect
-    object0->createEffectSurface();
+// minimum period [s] between two packets sent by the haptic thread
+const double TELEOP_SEND_PERIOD = 0.001;
 
-    // create a haptic magnetic effect
-    //object0->createEffectMagnetic();
+// time [s] without packets after which the remote station is considered gone
+const double TELEOP_TIMEOUT = 0.5;
 
-    // create a haptic viscous effect
-    //object0->createEffectViscosity();
+// rate [s per packet] at which the clock offset estimate follows clock drift
+const double TELEOP_OFFSET_LEAK = 1e-6;
 
+// a bounded single-producer single-consumer queue; a full queue drops packets
+struct TeleopQueue
+{
+    TeleopArrival items[TELEOP_QUEUE];
+    atomic<uint32_t> head;
+    atomic<uint32_t> tail;
+    atomic<uint64_t> dropped;
 
-    ////////////////////////////////////////////////////////////////////////
-    // OBJECT 1: "FLUID"
-    ////////////////////////////////////////////////////////////////////////
+    bool push(const TeleopArrival& a_item)
+    {
+        uint32_t h = head.load(memory_order_relaxed);
+        if (h - tail.load(memory_order_acquire) >= TELEOP_QUEUE)
+        {
+            dropped.fetch_add(1, memory_order_relaxed);
+            return (false);
+        }
+        items[h % TELEOP_QUEUE] = a_item;
+        head.store(h + 1, memory_order_release);
+        return (true);
+    }
 
-    // create a sphere and define its radius
-    object1 = new cShapeSphere(0.3);
+    bool pop(TeleopArrival& a_item)
+    {
+        uint32_t t = tail.load(memory_order_relaxed);
+        if (t == head.load(memory_order_acquire)) { return (false); }
+        a_item = items[t % TELEOP_QUEUE];
+        tail.store(t + 1, memory_order_release);
+        return (true);
+    }
+};
 
-    // add object to world
-    //world->addChild(object1);
+// packets from the haptic thread to the network thread
+TeleopQueue teleopOutgoing;
 
-    // set the position of the object at the center of the world
-    object1->setLocalPos(0.0, 0, 0.0);
+// packets from the network thread to the haptic thread
+TeleopQueue teleopIncoming;
 
-    // load texture map
-    object1->m_texture = cTexture2d::create();
-    //fileload = object1->m_texture->loadFromFile(currentpath + "../resources/images/spheremap-2.jpg"); //blue
+// jitter buffer, ordered by sequence number; owned by the haptic thread
+TeleopArrival teleopJitter[TELEOP_JITTER];
+int teleopJitterCount = 0;
 
+// estimated offset between the local and remote clocks, plus the network delay [s]
+double teleopOffset = 0.0;
 
-    // set graphic properties
-    object1->m_material->setGray();
-    //object1->setTransparencyLevel(0.9);
-    object1->setUseTexture(true);
-    object1->m_texture->setSphericalMappingEnabled(true);
+// highest sequence number received and last sequence number played out
+uint32_t teleopHighest = 0;
+uint32_t teleopPlayed = 0;
 
-    // set haptic properties
-    object1->m_material->setViscosity(0.9 * maxDamping);    // % of maximum linear damping
+// packets received among the latest sequence numbers; bit i is set when packet
+// teleopHighest - i was received, so that duplicates can be told from reordering
+uint64_t teleopReceivedMask = 0;
 
-    // create a haptic viscous effect
-    object1->createEffectViscosity();
+// local time of the latest packet received
+double teleopLastArrival = -1.0;
 
+// statistics of the teleoperation channel
+uint64_t teleopReceived = 0;
+uint64_t teleopLost = 0;
+uint64_t teleopLate = 0;
+uint64_t teleopUnderruns = 0;
+uint64_t teleopDuplicates = 0;
 
-    /////////////////////////////////////////////////////////////////////////
-    // OBJECT 2: "STICK-SLIP"
-    /////////////////////////////////////////////////////////////////////////
+// cutoff frequency [Hz] of the low-pass filter applied to received wave variables;
+// filtering the waves damps reflections on the link without adding energy
+const double TELEOP_WAVE_CUTOFF = 30.0;
 
-    // create a sphere by defini its radius
-    object2 = new cShapeSphere(0.3);
+// rate [1/s] at which a free proxy is pulled back to the remote tool position
+const double TELEOP_DRIFT_GAIN = 5.0;
 
-    // add object to world
-    world->addChild(object2);
+// stiffness [N/m] of the contact between the local tool and the remote tool proxy
+double teleopStiffness = 0.0;
 
-    // set the position of the object at the center of the world
-    object2->setLocalPos(0.0, 1, 0);
+// state of the wave-variable coupling, owned by the haptic thread
+/*
+    Each station runs two halves of a wave-variable link:
+    - the local tool is the master of a link whose slave is a proxy of this
+      tool at the remote station;
+    - a proxy of the remote tool is the slave of the link mastered by the
+      remote tool, and is touched by the local tool.
+    Wave variables keep each link passive for any constant delay, so touch
+    between the two tools stays stable under latency.
+*/
+bool teleopCoupled = false;
+cVector3d remoteProxyPos;
+cVector3d teleopWaveIn;
+cVector3d teleopReturnIn;
 
-    // load texture map
-    object2->m_texture = cTexture2d::create();
-    //fileload = object2->m_texture->loadFromFile(currentpath + "../resources/images/spheremap-5.jpg"); //white holes
+// the proxy of the remote tool, posed by the graphic thread
+cShapeSphere* remoteToolDisplay = nullptr;
 
+// teleoperation network thread
+bool teleopRunning = false;
+bool teleopFinished = true;
+cThread* teleopThread = nullptr;
 
-    // set graphic properties
-    object2->m_texture->setSphericalMappingEnabled(true);
-    object2->m_material->setGray();
-    object2->setUseTexture(true);
 
-    // set haptic properties
-    object2->m_material->setStickSlipForceMax(0.2 * maxLinearForce);// % of maximum linear force
-    object2->m_material->setStickSlipStiffness(0.6 * maxStiffness); // % of maximum linear stiffness
-    //object2->m_material->setViscosity(-1* maxDamping); // % of maximum linear stiffness
+//------------------------------------------------------------------------------
+// DECLARED FUNCTIONS
+//------------------------------------------------------------------------------
 
-    // create a haptic stick-slip effect
-    object2->createEffectStickSlip();
+// callback when the window is resized
+void onWindowSizeCallback(GLFWwindow* a_window, int a_width, int a_height);
 
-    //object2->createEffectViscosity();
-    // create a haptic stick-slip effect
-    //object2->setuse();
+// callback when the window framebuffer is resized
+void onFrameBufferSizeCallback(GLFWwindow* a_window, int a_width, int a_height);
 
+// callback when an error GLFW occurs
+void onErrorCallback(int a_error, const char* a_description);
 
-    ////////////////////////////////////////////////////////////////////////
-    // OBJECT 3: "VIBRATIONS"
-    ////////////////////////////////////////////////////////////////////////
+// callback when a key is pressed
+void onKeyCallback(GLFWwindow* a_window, int a_key, int a_scancode, int a_action, int a_mods);
 
-    // create a sphere and define its radius
-    object3 = new cShapeSphere(0.5);
+// callback when window content scaling is modified
+void onWindowContentScaleCallback(GLFWwindow* a_window, float a_xscale, float a_yscale);
 
-    // add object to world
-    world->addChild(object3);
+// this function contains the main graphics rendering loop
+void renderGraphicsLoop(void);
 
-    // set the position of the object at the center of the world
-    object3->setLocalPos(0, 0.0, 0);
+// this function applies the latest display state published by the event thread
+void consumeDisplayState(void);
 
-    // load texture map
-    object3->m_texture = cTexture2d::create();
+// this function renders the scene
+void renderGraphics(void);
 
+// this function contains the main haptics simulation loop
+void renderHaptics(void);
 
-    // set graphic properties
-    object3->m_texture->setSphericalMappingEnabled(true);
-    object3->setUseTexture(true);
-    object3->m_material->setGray();
-    //object3->setTransparencyLevel(0.9);
+// this function closes the application
+void close(void);
 
-    // set haptic properties
-    object3->m_material->setVibrationFrequency(60);
-    object3->m_material->setVibrationAmplitude(0.5 * maxLinearForce);   // % of maximum linear force
-    object3->m_material->setStiffness(0.1);   
-    //object3->m_material->setViscosity(0.9 * maxDamping); // % of maximum linear stiffness
-    //object3->m_material->setMagnetMaxForce(0.8 * maxLinearForce);   // % of maximum linear force 
-    //object3->m_material->setMagnetMaxDistance(0.3);
-    // create a haptic vibration effect
-    object3->createEffectVibration();
+// this function checks the fields of a scene object read from a text or binary scene
+bool validateSceneObject(const SceneObjectDesc& a_desc, string& a_error);
 
-    // create a haptic surface effect
-    object3->createEffectSurface();
-    object3->createEffectViscosity();
-    // create a haptic magnetic effect
-    //object3->createEffectMagnetic();
-   
-    //--------------------------------------------------------------------------
-    // WIDGETS
-    //--------------------------------------------------------------------------
+// this function parses a scene in text format
+bool parseScene(const char* a_text, size_t a_length, vector<SceneObjectDesc>& a_descs);
 
-    // create a font
-    font = NEW_CFONT_CALIBRI_20();
-    
-    // create a label to display the haptic and graphic rate of the simulation
-    labelRates = new cLabel(font);
-    camera->m_frontLayer->addChild(labelRates);
+// this function loads a scene file in text or binary format
+bool loadScene(const string& a_filename, vector<SceneObjectDesc>& a_descs);
 
+// this function saves a scene in binary format
+bool saveSceneBinary(const string& a_filename, const vector<SceneObjectDesc>& a_descs);
 
-    //--------------------------------------------------------------------------
-    // VIEWPORT DISPLAY
-    //--------------------------------------------------------------------------
+// this function creates the objects, effects and behaviors of a scene
+void buildScene(const vector<SceneObjectDesc>& a_descs, double a_maxLinearForce,
+                double a_maxStiffness, double a_maxDamping);
 
-    // get content scale factor
-    float contentScaleW, contentScaleH;
-    glfwGetWindowContentScale(window, &contentScaleW, &contentScaleH);
+// this function parses a vibrotactile pattern
+bool parseWaveform(const char* a_pattern, vector<WaveVoice>& a_voices);
 
-    // create a viewport to display the scene.
-    viewport = new cViewport(camera, contentScaleW, contentScaleH);
+// this function compiles the pattern of an oscillator into a table of per-tick forces
+bool compileWaveform(const SceneObjectDesc& a_desc, double a_timeStep, vector<float>& a_table);
 
+// this function loads an image from the resource directories
+bool loadResourceImage(const string& a_filename, cImagePtr a_image);
 
-    //--------------------------------------------------------------------------
-    // START HAPTIC SIMULATION THREAD
-    //--------------------------------------------------------------------------
+// this function returns the haptic texture of a height map and a friction map, building it if needed
+shared_ptr<HapticTexture> getHapticTexture(const string& a_heightMap, const string& a_frictionMap);
 
-    // create a thread which starts the main haptics rendering loop
-    hapticsThread = new cThread();
-    hapticsThread->start(renderHaptics, CTHREAD_PRIORITY_HAPTICS);
+// this function samples a height or friction map from an image or a procedural pattern
+bool loadHapticMap(const string& a_name, int& a_width, int& a_height, vector<float>& a_values);
 
-    // setup callback when application exits
-    atexit(close);
+// this function computes the force of the haptic texture of an object in contact with the tool
+cVector3d computeTextureForce(const SceneObject& a_object, const cVector3d& a_toolPos,
+                              const cVector3d& a_toolVel, const cVector3d& a_contactForce);
 
+// this function loads a viscosity field; viscosities are fractions of a_maxDamping
+bool loadViscosityField(const string& a_filename, double a_maxDamping, VoxelField& a_field);
 
-    //--------------------------------------------------------------------------
-    // MAIN GRAPHIC LOOP
-    //--------------------------------------------------------------------------
+// this function computes the force of the viscosity field on the tool
+cVector3d sampleViscosityField(const VoxelField& a_field, const cVector3d& a_pos, const cVector3d& a_vel);
 
-    // main graphic loop
-    while (!glfwWindowShouldClose(window))
-    {
-        // render graphics
-        renderGraphics();
+// this function creates the compile-time fused effect of a combination of effects
+FusedEffect* createEffectKernel(cGenericObject* a_parent, uint32_t a_effects, SceneArena& a_arena);
 
-        // process events
-        glfwPollEvents();
-    }
+// this function copies the positions of moved objects from the transform table to their nodes
+void syncTransforms(void);
 
-    // close window
-    glfwDestroyWindow(window);
+// this function marks the start of a haptic tick, which must not allocate memory, take locks or wait
+void beginRealtimeSection(void);
 
-    // terminate GLFW library
-    glfwTerminate();
+// this function marks the end of a haptic tick
+void endRealtimeSection(void);
 
-    // exit
-    return (0);
-}
+// this function reports an allocation, a lock acquisition or a wait during a haptic tick
+void reportRealtimeViolation(const char* a_what);
 
-//------------------------------------------------------------------------------
+// this function computes the haptic parameters of a scene object
+void computeHapticParams(const SceneObjectDesc& a_desc, HapticParams& a_params);
 
-void onWindowSizeCallback(GLFWwindow* a_window, int a_width, int a_height)
-{
-    // update window size
-    windowW = a_width;
-    windowH = a_height;
+// this function returns the texture shared by all objects using an image, and
+// queues the image for decoding the first time it is requested
+cTexture2dPtr getSharedTexture(const string& a_filename, bool a_sphericalMapping);
 
-    // render scene
-    renderGraphics();
-}
+// this function starts the texture loading threads
+void startTextureLoading(void);
 
-//------------------------------------------------------------------------------
+// this function decodes queued images; it runs on the texture loading threads
+void loadTextures(void);
 
-void onFrameBufferSizeCallback(GLFWwindow* a_window, int a_width, int a_height)
-{
-    // update frame buffer size
-    framebufferW = a_width;
-    framebufferH = a_height;
-}
+// this function installs decoded images into their textures; it is called by the render thread
+void installDecodedTextures(void);
 
-//------------------------------------------------------------------------------
+// this function reloads the haptic parameters from the scene file
+bool reloadHapticParams(void);
 
-void onWindowContentScaleCallback(GLFWwindow* a_window, float a_xscale, float a_yscale)
-{
-    // update window content scale factor
-    viewport->setContentScale(a_xscale, a_yscale);
-}
+// this function applies reloaded parameters; it is called by the haptic thread
+void applyHapticParams(void);
 
-//------------------------------------------------------------------------------
+// this function watches the text or binary scene file and reloads parameters when it changes
+void watchHapticParams(void);
 
-void onErrorCallback(int a_error, const char* a_description)
-{
-    cout << "Error: " << a_description << endl;
-}
+// this function publishes the poses of the current haptic tick
+void publishPoses(const PoseData& a_pose);
 
-//------------------------------------------------------------------------------
+// this function reads a pose sample from the pose history
+bool readPoseSample(unsigned int a_index, PoseData& a_pose);
 
-void onKeyCallback(GLFWwindow* a_window, int a_key, int a_scancode, int a_action, int a_mods)
-{
-    // filter calls that only include a key press
-    if ((a_action != GLFW_PRESS) && (a_action != GLFW_REPEAT))
-    {
-        return;
-    }
+// this function interpolates the pose history a fixed latency behind the latest sample
+bool samplePoses(double a_latency, PoseData& a_pose);
 
-    // option - exit
-    else if ((a_key == GLFW_KEY_ESCAPE) || (a_key == GLFW_KEY_Q))
-    {
-        glfwSetWindowShouldClose(a_window, GLFW_TRUE);
-    }
+// this function poses the display copies from the pose history
+void updateDisplayPoses(void);
 
-    // option - toggle fullscreen
-    else if (a_key == GLFW_KEY_F)
-    {
-        // toggle state variable
-        fullscreen = !fullscreen;
+// this function creates the offscreen framebuffer and its readback buffers
+bool createOffscreenBuffer(int a_width, int a_height);
 
-        // get handle to monitor
-        GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+// this function releases the offscreen framebuffer and its readback buffers
+void destroyOffscreenBuffer(void);
 
-        // get information about monitor
-        const GLFWvidmode* mode = glfwGetVideoMode(monitor);
+// this function starts an asynchronous readback of the offscreen framebuffer
+void queueFrameReadback(int a_frame);
 
-        // set fullscreen or window mode
-        if (fullscreen)
-        {
-            glfwSetWindowMonitor(window, monitor, 0, 0, mode->width, mode->height, mode->refreshRate);
-        }
-        else
-        {
-            int w = 0.8 * mode->height;
-            int h = 0.5 * mode->height;
-            int x = 0.5 * (mode->width - w);
-            int y = 0.5 * (mode->height - h);
-            glfwSetWindowMonitor(window, NULL, x, y, w, h, mode->refreshRate);
-        }
+// this function collects a completed readback and hands it to the writer thread
+void collectFrameReadback(int a_buffer);
 
-        // set the desired swap interval and number of samples to use for multisampling
-        glfwSwapInterval(swapInterval);
-        glfwWindowHint(GLFW_SAMPLES, 4);
-    }
+// this function collects all pending readbacks
+void flushFrameReadbacks(void);
 
-    // option - toggle vertical mirroring
-    else if (a_key == GLFW_KEY_M)
-    {
-        mirroredDisplay = !mirroredDisplay;
-        camera->setMirrorVertical(mirroredDisplay);
-    }
-}
+// this function writes captured frames to disk
+void writeCapturedFrames(void);
 
-//------------------------------------------------------------------------------
+// this function selects single-pass or two-pass rendering of passive stereo modes
+void setStereoRendering(bool a_singlePass);
 
-void close(void)
-{
-    // stop the simulation
-    simulationRunning = false;
+// this function enables or disables the GPU profiler
+void setProfilerEnabled(bool a_enabled);
 
-    // wait for graphics and haptics loops to terminate
-    while (!simulationFinished) { cSleepMs(100); }
+// this function starts profiling a new frame
+void profilerBeginFrame(void);
 
-    // close haptic device
-    tool->stop();
+// this function records a GPU timestamp for the current frame
+void profilerMark(int a_mark);
 
-    // delete resources
-    delete hapticsThread;
-    delete world;
-    delete handler;
-}
+// this function updates the profiler widgets
+void updateProfilerWidgets(int a_displayW, int a_displayH);
 
-//------------------------------------------------------------------------------
+// this function exports the profiler history to a CSV file
+void exportProfilerHistory(const string& a_filename);
 
+// this function records a phase that started at a_begin and returns its end time
+double traceRecord(int a_thread, const char* a_name, double a_begin);
 
+// this function writes the recorded events to a Chrome trace file
+void exportTrace(const string& a_filename);
 
-void renderGraphics(void)
-{
-    // sanity check
-    if (viewport == nullptr) { return; }
+// this function returns a mask of the scene objects in contact with the tool
+uint32_t computeContactMask(void);
 
-    /////////////////////////////////////////////////////////////////////
-    // UPDATE WIDGETS
-    /////////////////////////////////////////////////////////////////////
+// this function prints the scene events broadcast by the server (viewer side)
+void reportSceneEvents(void);
 
-    // get width and height of CHAI3D internal rendering buffer
-    int displayW = viewport->getDisplayWidth();
-    int displayH = viewport->getDisplayHeight();
+// this function updates the haptic statistics for one tick
+void updateHapticStats(HapticStats& a_stats, double a_loopTime, double a_timeStep,
+                       const cVector3d& a_force, uint32_t a_contacts);
 
-    // update haptic and graphic rate data
-    labelRates->setText(cStr(freqCounterGraphics.getFrequency(), 0) + " Hz / " +
-                        cStr(freqCounterHaptics.getFrequency(), 0) + " Hz");
+// this function publishes the haptic statistics to the metrics server
+void publishHapticMetrics(const HapticStats& a_stats);
 
-    // update position of label
-    labelRates->setLocalPos((int)(0.5 * (displayW - labelRates->getWidth())), 15);
+// this function formats the metrics in Prometheus text format
+string formatMetrics(void);
 
+// this function serves the metrics over HTTP
+void serveMetrics(void);
 
-    /////////////////////////////////////////////////////////////////////
-    // RENDER SCENE
-    /////////////////////////////////////////////////////////////////////
+// this function creates a session log file
+bool openSessionLog(const string& a_filename);
 
-    // update shadow maps (if any)
-    world->updateShadowMaps(false, mirroredDisplay);
+// this function appends a haptic sample to the session log
+void logSample(const PoseData& a_pose, const cVector3d& a_toolPos, const cVector3d& a_force, uint32_t a_contacts);
 
-    // render world
-    viewport->renderView(framebufferW, framebufferH);
+// this function writes completed chunks of the session log to disk
+void writeSessionLog(void);
 
-    // wait until all GL commands are completed
-    glFinish();
+// this function writes a session log to standard output as CSV
+bool dumpSessionLog(const string& a_filename);
 
-    // check for any OpenGL errors
-    GLenum error = glGetError();
-    if (error != GL_NO_ERROR) cout << "Error: " << gluErrorString(error) << endl;
+// this function moves received packets into the jitter buffer and plays out the remote tool
+bool playoutRemoteTool(double a_time, TeleopPacket& a_sample);
 
-    // swap buffers
-    glfwSwapBuffers(window);
+// this function couples the local tool with the remote station and returns the force on the tool
+cVector3d computeWaveCoupling(const TeleopPacket& a_remote, bool a_active, const cVector3d& a_toolPos,
+                              const cVector3d& a_toolVel, double a_dt, TeleopPacket& a_outgoing);
 
-    // signal frequency counter
-    freqCounterGraphics.signal(1);
-}
+// this function sends and receives teleoperation packets
+void runTeleopNetwork(void);
 
 
+//==============================================================================
 
-bool inLoop = false;
+//==============================================================================
 
-void renderHaptics(void)
+int main(int argc, char* argv[])
+{
+    //--------------------------------------------------------------------------
+    // INITIALIZATION
+    //--------------------------------------------------------------------------
+
+    cout << endl;
+    cout << "-----------------------------------" << endl;
+    cout << "CHAI3D" << endl;
+    cout << "Demo: 11-effects" << endl;
+    cout << "Copyright 2003-2024" << endl;
+    cout << "-----------------------------------" << endl << endl << endl;
+    cout << "Keyboard Options:" << endl << endl;
+    cout << "[f] - Enable/Disable full screen mode" << endl;
+    cout << "[m] - Enable/Disable vertical mirroring" << endl;
+    cout << "[s] - Switch between single-pass and two-pass stereo" << endl;
+    cout << "[p] - Enable/Disable GPU profiler" << endl;
+    cout << "[c] - Export GPU profile to CSV file" << endl;
+    cout << "[t] - Export thread timeline to trace.json" << endl;
+    cout << "[q] - Exit application" << endl;
+    cout << endl;
+    cout << "Command Line Options:" << endl << endl;
+    cout << "--offscreen    - Render into an offscreen framebuffer (headless)" << endl;
+    cout << "--size WxH     - Size of the offscreen framebuffer" << endl;
+    cout << "--capture N    - Write the first N offscreen frames to disk" << endl;
+    cout << "--frames N     - Exit after rendering N frames" << endl;
+    cout << "--gl33         - Render spheres with the OpenGL 3.3 shader backend" << endl;
+    cout << "--stereo MODE  - Stereo mode: mono, active, left-right or top-bottom" << endl;
+    cout << "--two-pass-stereo - Render each eye separately in passive stereo modes" << endl;
+    cout << "--stock-effects - Evaluate each haptic effect separately instead of fusing them" << endl;
+    cout << "--runtime-effects - Fuse haptic effects without compile-time specialization" << endl;
+    cout << "--scene FILE   - Load the scene from a text or binary scene file" << endl;
+    cout << "--field FILE   - Apply the viscosity field described in FILE" << endl;
+    cout << "--compile-scene IN OUT - Convert a scene file to binary format and exit" << endl;
+    cout << "--export-scene FILE    - Write the built-in scene to a text file and exit" << endl;
+    cout << "--trace FILE   - Write the thread timeline to FILE on exit" << endl;
+    cout << "--metrics PORT - Serve Prometheus metrics on http://127.0.0.1:PORT/metrics" << endl;
+    cout << "--log FILE     - Record haptic samples to a compressed session log" << endl;
+    cout << "--dump-log FILE        - Print a session log as CSV and exit" << endl;
+    cout << "--teleop PORT HOST:PORT - Share the tool with a remote station over UDP" << endl;
+    cout << "--jitter MS    - Delay of the teleoperation jitter buffer (default 20 ms, at most 63 ms)" << endl;
+    cout << "--impedance B  - Wave impedance of the teleoperation coupling (default 4 N.s/m)" << endl;
+    cout << "--delay MS     - Add an artificial delay to outgoing teleoperation packets" << endl;
+    cout << "--share-state  - Publish the scene state in shared memory for viewers" << endl;
+    cout << "--viewer       - Display the scene state shared by another instance (read-only)" << endl;
+    cout << "--telemetry    - Publish haptic telemetry in shared memory (" << TELEMETRY_SHM_NAME << ")" << endl;
+    cout << endl;
+    cout << "Teleoperation can be tested on one machine with two instances:" << endl;
+    cout << "    --teleop 5000 127.0.0.1:5001   and   --teleop 5001 127.0.0.1:5000" << endl;
+    cout << endl;
+    cout << "Haptic parameters (material properties and behavior parameters) of a text or" << endl;
+    cout << "binary scene are reloaded while running whenever the scene file is saved." << endl;
+    cout << endl << endl;
+
+
+    //--------------------------------------------------------------------------
+    // COMMAND LINE OPTIONS
+    //--------------------------------------------------------------------------
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--offscreen")
+        {
+            offscreen = true;
+        }
+        else if ((arg == "--size") && (i + 1 < argc))
+        {
+            int w, h;
+            if ((sscanf(argv[++i], "%dx%d", &w, &h) != 2) || (w <= 0) || (h <= 0) ||
+                (w > MAX_OFFSCREEN_SIZE) || (h > MAX_OFFSCREEN_SIZE))
+            {
+                cout << "Error: invalid size " << argv[i] << " (expected WxH, at most " <<
+                        MAX_OFFSCREEN_SIZE << " pixels each)" << endl;
+                return 1;
+            }
+            offscreenW = w;
+            offscreenH = h;
+        }
+        else if ((arg == "--capture") && (i + 1 < argc))
+        {
+            char* end;
+            long n = strtol(argv[++i], &end, 10);
+            if ((end == argv[i]) || (*end != 0) || (n < 0) || (n > INT_MAX))
+            {
+                cout << "Error: invalid capture count " << argv[i] << " (expected a non-negative integer)" << endl;
+                return 1;
+            }
+            captureFrames = (int)n;
+        }
+        else if ((arg == "--frames") && (i + 1 < argc))
+        {
+            char* end;
+            long n = strtol(argv[++i], &end, 10);
+            if ((end == argv[i]) || (*end != 0) || (n < 0) || (n > INT_MAX))
+            {
+                cout << "Error: invalid frame count " << argv[i] << " (expected a non-negative integer)" << endl;
+                return 1;
+            }
+            maxFrames = (int)n;
+        }
+        else if (arg == "--gl33")
+        {
+            modernRenderer = true;
+        }
+        else if ((arg == "--stereo") && (i + 1 < argc))
+        {
+            string mode = argv[++i];
+            if (mode == "mono")                 { stereoMode = C_STEREO_DISABLED; }
+            else if (mode == "active")          { stereoMode = C_STEREO_ACTIVE; }
+            else if (mode == "left-right")      { stereoMode = C_STEREO_PASSIVE_LEFT_RIGHT; }
+            else if (mode == "top-bottom")      { stereoMode = C_STEREO_PASSIVE_TOP_BOTTOM; }
+            else
+            {
+                cout << "Error: unknown stereo mode " << mode <<
+                        " (expected mono, active, left-right or top-bottom)" << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--two-pass-stereo")
+        {
+            singlePassStereo = false;
+        }
+        else if (arg == "--stock-effects")
+        {
+            stockEffects = true;
+        }
+        else if (arg == "--runtime-effects")
+        {
+            runtimeEffects = true;
+        }
+        else if ((arg == "--scene") && (i + 1 < argc))
+        {
+            sceneFile = argv[++i];
+        }
+        else if ((arg == "--field") && (i + 1 < argc))
+        {
+            fieldFile = argv[++i];
+        }
+        else if ((arg == "--compile-scene") && (i + 2 < argc))
+        {
+            vector<SceneObjectDesc> descs;
+            if (!loadScene(argv[i + 1], descs) || !saveSceneBinary(argv[i + 2], descs))
+            {
+                return 1;
+            }
+            cout << "compiled " << descs.size() << " objects to " << argv[i + 2] << endl;
+            return 0;
+        }
+        else if ((arg == "--export-scene") && (i + 1 < argc))
+        {
+            FILE* file = fopen(argv[i + 1], "w");
+            if ((file == NULL) || (fputs(defaultScene, file) < 0))
+            {
+                cout << "failed to write " << argv[i + 1] << endl;
+                return 1;
+            }
+            fclose(file);
+            return 0;
+        }
+        else if ((arg == "--trace") && (i + 1 < argc))
+        {
+            traceFile = argv[++i];
+        }
+        else if ((arg == "--metrics") && (i + 1 < argc))
+        {
+            metricsPort = atoi(argv[++i]);
+        }
+        else if ((arg == "--log") && (i + 1 < argc))
+        {
+            logFile = argv[++i];
+        }
+        else if ((arg == "--dump-log") && (i + 1 < argc))
+        {
+            return (dumpSessionLog(argv[i + 1]) ? 0 : 1);
+        }
+        else if ((arg == "--teleop") && (i + 2 < argc))
+        {
+            teleopPort = atoi(argv[++i]);
+            teleopPeer = argv[++i];
+        }
+        else if ((arg == "--jitter") && (i + 1 < argc))
+        {
+            // the jitter buffer must hold the packets sent during the delay
+            const double maxDelay = 1000.0 * (TELEOP_JITTER - 1) * TELEOP_SEND_PERIOD;
+            char* end;
+            double delay = strtod(argv[++i], &end);
+            if ((end == argv[i]) || (*end != 0) || !(delay >= 0.0) || (delay > maxDelay))
+            {
+                cout << "Error: invalid jitter delay " << argv[i] << " (expected 0 to " << maxDelay << " ms)" << endl;
+                return 1;
+            }
+            teleopJitterDelay = 0.001 * delay;
+        }
+        else if ((arg == "--impedance") && (i + 1 < argc))
+        {
+            teleopImpedance = cMax(atof(argv[++i]), 0.01);
+        }
+        else if ((arg == "--delay") && (i + 1 < argc))
+        {
+            teleopDelay = cMax(0.001 * atof(argv[++i]), 0.0);
+        }
+        else if (arg == "--telemetry")
+        {
+            telemetryEnabled = true;
+        }
+        else if (arg == "--share-state")
+        {
+            shareState = true;
+        }
+        else if (arg == "--viewer")
+        {
+            viewerMode = true;
+        }
+    }
+
+    // a viewer runs no haptic simulation; it only displays the shared scene state
+    if (viewerMode)
+    {
+        shareState = false;
+        telemetryEnabled = false;
+        logFile.clear();
+        metricsPort = 0;
+        teleopPort = 0;
+        fieldFile.clear();
+    }
+
+
+    //--------------------------------------------------------------------------
+    // OPEN GL - WINDOW DISPLAY
+    //--------------------------------------------------------------------------
+
+#ifdef GLFW_PLATFORM_NULL
+    // in offscreen mode, no display server is required
+    if (offscreen)
+    {
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    }
+#endif
+
+    // initialize GLFW library
+    if (!glfwInit())
+    {
+        cout << "failed initialization" << endl;
+        cSleepMs(1000);
+        return 1;
+    }
+
+    // set GLFW error callback
+    glfwSetErrorCallback(onErrorCallback);
+
+    // compute desired size of window
+    int x = 0;
+    int y = 0;
+    if (offscreen)
+    {
+        windowW = offscreenW;
+        windowH = offscreenH;
+    }
+    else
+    {
+        const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+        windowW = 0.8 * mode->height;
+        windowH = 0.5 * mode->height;
+        x = 0.5 * (mode->width - windowW);
+        y = 0.5 * (mode->height - windowH);
+    }
+
+    // set OpenGL version; the 3.3 backend uses a compatibility profile since the
+    // widgets and remaining objects are still drawn by the fixed-function path
+    if (modernRenderer)
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_COMPAT_PROFILE);
+    }
+    else
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    }
+
+    // enable double buffering
+    glfwWindowHint(GLFW_DOUBLEBUFFER, GLFW_TRUE);
+
+    // set the desired number of samples to use for multisampling
+    glfwWindowHint(GLFW_SAMPLES, 4);
+
+    // specify that window should be resized based on monitor content scale
+    glfwWindowHint(GLFW_SCALE_TO_MONITOR, GLFW_TRUE);
+
+    // in offscreen mode, the window is only used to hold the display context
+    if (offscreen)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef GLFW_OSMESA_CONTEXT_API
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+    }
+
+    // set active stereo mode
+    if (stereoMode == C_STEREO_ACTIVE)
+    {
+        glfwWindowHint(GLFW_STEREO, GL_TRUE);
+    }
+    else
+    {
+        glfwWindowHint(GLFW_STEREO, GL_FALSE);
+    }
+
+    // create display context
+    window = glfwCreateWindow(windowW, windowH, "CHAI3D", NULL, NULL);
+    if (!window)
+    {
+        cout << "failed to create window" << endl;
+        cSleepMs(1000);
+        glfwTerminate();
+        return 1;
+    }
+
+    // set GLFW key callback
+    glfwSetKeyCallback(window, onKeyCallback);
+
+    // set GLFW window size callback
+    glfwSetWindowSizeCallback(window, onWindowSizeCallback);
+
+    // set GLFW framebuffer size callback
+    glfwSetFramebufferSizeCallback(window, onFrameBufferSizeCallback);
+
+    // set GLFW window content scaling callback
+    glfwSetWindowContentScaleCallback(window, onWindowContentScaleCallback);
+
+    // get width and height of window
+    glfwGetFramebufferSize(window, &framebufferW, &framebufferH);
+
+    // set position of window
+    glfwSetWindowPos(window, x, y);
+
+    // set window size
+    glfwSetWindowSize(window, windowW, windowH);
+
+    // set GLFW current display context
+    glfwMakeContextCurrent(window);
+
+#ifdef GLEW_VERSION
+    // initialize GLEW library
+    if (glewInit() != GLEW_OK)
+    {
+        cout << "failed to initialize GLEW library" << endl;
+        glfwTerminate();
+        return 1;
+    }
+#endif
+
+    // timestamp queries are core in OpenGL 3.3, and an extension before
+    profilerSupported = (glfwExtensionSupported("GL_ARB_timer_query") == GLFW_TRUE) ||
+                        (glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MAJOR) * 10 +
+                         glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MINOR) >= 33);
+
+    // create offscreen framebuffer
+    if (offscreen)
+    {
+        if (!createOffscreenBuffer(offscreenW, offscreenH))
+        {
+            cout << "failed to create offscreen framebuffer" << endl;
+            glfwTerminate();
+            return 1;
+        }
+        framebufferW = offscreenW;
+        framebufferH = offscreenH;
+    }
+
+    // start capture writer thread
+    if (offscreen && (captureFrames > 0))
+    {
+        captureRunning = true;
+        captureFinished = false;
+        captureThread = new cThread();
+        captureThread->start(writeCapturedFrames, CTHREAD_PRIORITY_GRAPHICS);
+    }
+
+
+    //--------------------------------------------------------------------------
+    // WORLD - CAMERA - LIGHTING
+    //--------------------------------------------------------------------------
+
+    // create a new world.
+    world = new cWorld();
+
+    // set the background color of the environment
+    world->m_backgroundColor.setWhite();
+
+    // insert a probe that marks the beginning of each render pass of the world;
+    // it must remain the first child so that it is rendered before any object
+    world->addChild(new cTimestampProbe(false));
+
+    // create a camera and insert it into the virtual world
+    camera = new cCamera(world);
+    world->addChild(camera);
+
+    // position and orient the camera
+    camera->set(cVector3d(3.0, 0.0, 0.0),    // camera position (eye)
+                cVector3d(0.0, 0.0, 0.0),    // lookat position (target)
+                cVector3d(0.0, 0.0, 1.0));   // direction of the (up) vector
+
+    // set the near and far clipping planes of the camera
+    // anything in front or behind these clipping planes will not be rendered
+    camera->setClippingPlanes(0.01, 10.0);
+
+    // set stereo mode
+    camera->setStereoMode(stereoMode);
+
+    // set stereo eye separation and focal length (applies only if stereo is enabled)
+    camera->setStereoEyeSeparation(0.03);
+    camera->setStereoFocalLength(3.0);
+
+    // set vertical mirrored display mode
+    camera->setMirrorVertical(mirroredDisplay);
+
+    // enable multi-pass rendering to handle transparent objects
+    camera->setUseMultipassTransparency(true);
+
+
+    // create a light source
+    light = new (displayArena) ArenaNode<cSpotLight>(world);
+
+    // add light to world
+    world->addChild(light);
+
+    // enable light source
+    light->setEnabled(true);
+
+    // position the light source
+    light->setLocalPos(1, 1, 1);
+
+    // define the direction of the light beam
+    light->setDir(-1, -1, -1.0);
+
+    // set light cone half angle
+    light->setCutOffAngleDeg(60);
+
+    //--------------------------------------------------------------------------
+    // HAPTIC DEVICES / TOOLS
+    //--------------------------------------------------------------------------
+
+    // create a haptic device handler
+    handler = new cHapticDeviceHandler();
+
+    // get access to the first available haptic device found
+    handler->getDevice(hapticDevice, 0);
+
+    // retrieve information about the current haptic device
+    cHapticDeviceInfo hapticDeviceInfo = hapticDevice->getSpecifications();
+
+    // create a tool (cursor) and insert into the world
+    tool = new cToolCursor(world);
+    world->addChild(tool);
+
+    // connect the haptic device to the virtual tool
+    tool->setHapticDevice(hapticDevice);
+
+    // define a radius for the virtual tool (sphere)
+    tool->setRadius(0.03);
+    // map the physical workspace of the haptic device to a larger virtual workspace.
+    tool->setWorkspaceRadius(1.0);
+
+    // haptic forces are enabled only if small forces are first sent to the device;
+    // this mode avoids the force spike that occurs when the application starts when 
+    // the tool is located inside an object for instance. 
+    tool->setWaitForSmallForce(true);
+
+    // start the haptic tool (a viewer does not use the haptic device)
+    if (!viewerMode)
+    {
+        tool->start();
+    }
+
+    // the tool is displayed by a copy posed by the graphic thread, so that its
+    // motion is interpolated between haptic samples
+    tool->setShowEnabled(false);
+    toolDisplay = new (displayArena) ArenaNode<cShapeSphere>(0.03);
+    world->addChild(toolDisplay);
+    toolDisplay->m_material->setBlueRoyal();
+    toolDisplay->setHapticEnabled(false);
+
+
+    //--------------------------------------------------------------------------
+    // CREATING OBJECTS
+    //--------------------------------------------------------------------------
+
+    // read the scale factor between the physical workspace of the haptic
+    // device and the virtual workspace defined for the tool
+    double workspaceScaleFactor = tool->getWorkspaceScaleFactor();
+
+    // get properties of haptic device
+    double maxLinearForce = cMin(hapticDeviceInfo.m_maxLinearForce, 7.0);
+    double maxStiffness = hapticDeviceInfo.m_maxLinearStiffness / workspaceScaleFactor;
+    double maxDamping   = hapticDeviceInfo.m_maxLinearDamping / workspaceScaleFactor;
+    deviceMaxLinearForce = maxLinearForce;
+    deviceMaxStiffness = maxStiffness;
+    deviceMaxDamping = maxDamping;
+
+    // load scene description
+    vector<SceneObjectDesc> sceneDescs;
+    cPrecisionClock loadClock;
+    loadClock.start(true);
+    if (sceneFile.empty())
+    {
+        parseScene(defaultScene, strlen(defaultScene), sceneDescs);
+    }
+    else if (!loadScene(sceneFile, sceneDescs))
+    {
+        cout << "failed to load scene " << sceneFile << endl;
+        glfwTerminate();
+        return 1;
+    }
+
+    // create objects, effects and behaviors
+    buildScene(sceneDescs, maxLinearForce, maxStiffness, maxDamping);
+
+    // load the viscosity field
+    if (!fieldFile.empty() && !loadViscosityField(fieldFile, maxDamping, viscosityField))
+    {
+        cout << "failed to load field " << fieldFile << endl;
+        glfwTerminate();
+        return 1;
+    }
+
+    // the tool of the remote station is represented by a proxy driven by the
+    // wave-variable coupling, shown while the remote station is connected; the
+    // contact between the tools is rendered at both stations, so each renders half
+    if ((teleopPort > 0) || viewerMode)
+    {
+        teleopStiffness = 0.5 * maxStiffness;
+        remoteToolDisplay = new (displayArena) ArenaNode<cShapeSphere>(0.03);
+        world->addChild(remoteToolDisplay);
+        remoteToolDisplay->m_material->setRedCrimson();
+        remoteToolDisplay->setHapticEnabled(false);
+        remoteToolDisplay->setEnabled(false);
+    }
+
+    // share the poses of the moving objects with viewer processes
+    if (shareState || viewerMode)
+    {
+        vector<const char*> names(numDynamicObjects);
+        for (unsigned int i = 0; i < sceneObjects.size(); i++)
+        {
+            if (sceneObjects[i].poseIndex >= 0)
+            {
+                names[sceneObjects[i].poseIndex] = sceneObjects[i].desc.name;
+            }
+        }
+
+        if (shareState && !sceneStateWriter.open(numDynamicObjects, names.data()))
+        {
+            cout << "Error: failed to create scene state " << SCENE_STATE_SHM_NAME << endl;
+            shareState = false;
+        }
+
+        // a viewer must build the same scene as the server
+        if (viewerMode)
+        {
+            bool valid = sceneStateReader.open() && (sceneStateReader.getNumObjects() == (uint32_t)numDynamicObjects);
+            for (int i = 0; valid && (i < numDynamicObjects); i++)
+            {
+                valid = (strcmp(sceneStateReader.getObjectName(i), names[i]) == 0);
+            }
+            if (!valid)
+            {
+                cout << "Error: no matching scene state " << SCENE_STATE_SHM_NAME <<
+                        " (start a server with --share-state and the same scene)" << endl;
+                glfwTerminate();
+                return 1;
+            }
+        }
+    }
+
+    // decode texture images in the background
+    startTextureLoading();
+    if (!sceneFile.empty())
+    {
+        cout << "loaded " << sceneObjects.size() << " objects from " << sceneFile << " in " <<
+                cStr(1000.0 * loadClock.getCurrentTimeSeconds(), 1) << " ms (" <<
+                hapticArena.getAllocatedSize() / 1024 << " KB in " << hapticArena.getNumChunks() << " chunks)" << endl;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // OPENGL 3.3 BACKEND
+    //--------------------------------------------------------------------------
+
+    // draw all visible spheres in a single instanced pass
+    if (modernRenderer)
+    {
+        sphereBatch = new cSphereBatch();
+        world->addChild(sphereBatch);
+        for (unsigned int i = 0; i < sceneObjects.size(); i++)
+        {
+            if (sceneObjects[i].desc.flags & FLAG_IN_WORLD)
+            {
+                sphereBatch->addSphere(sceneObjects[i].display);
+            }
+        }
+        sphereBatch->addSphere(toolDisplay);
+        if (remoteToolDisplay != nullptr)
+        {
+            sphereBatch->addSphere(remoteToolDisplay);
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    // WIDGETS
+    //--------------------------------------------------------------------------
+
+    // create a font
+    font = NEW_CFONT_CALIBRI_20();
+    
+    // insert a probe that marks the beginning of the front layer
+    camera->m_frontLayer->addChild(new cTimestampProbe(true));
+
+    // create an overlay that holds the widgets, so that they can be drawn per eye
+    stereoOverlay = new cStereoOverlay();
+    camera->m_frontLayer->addChild(stereoOverlay);
+
+    // create a label to display the haptic and graphic rate of the simulation
+    labelRates = new (displayArena) ArenaNode<cLabel>(font);
+    stereoOverlay->m_widgets->addChild(labelRates);
+
+    // create a scope to display the stacked duration of the render passes
+    scopeProfiler = new (displayArena) ArenaNode<cScope>();
+    stereoOverlay->m_widgets->addChild(scopeProfiler);
+    scopeProfiler->setSize(400, 120);
+    scopeProfiler->setRange(0.0, 20.0);
+    scopeProfiler->setSignalEnabled(true, true, true, true);
+    scopeProfiler->setTransparencyLevel(0.7f);
+    scopeProfiler->setShowEnabled(false);
+
+    // create a label to display the duration of each render pass
+    labelProfiler = new (displayArena) ArenaNode<cLabel>(font);
+    stereoOverlay->m_widgets->addChild(labelProfiler);
+    labelProfiler->setShowEnabled(false);
+
+    // passive stereo: the camera traverses the world once and the batch and the
+    // overlay draw both eyes; active stereo renders to two buffers and keeps the
+    // two passes
+    setStereoRendering(singlePassStereo);
+
+
+    //--------------------------------------------------------------------------
+    // VIEWPORT DISPLAY
+    //--------------------------------------------------------------------------
+
+    // get content scale factor
+    float contentScaleW, contentScaleH;
+    glfwGetWindowContentScale(window, &contentScaleW, &contentScaleH);
+
+    // create a viewport to display the scene.
+    viewport = new cViewport(camera, contentScaleW, contentScaleH);
+
+    // initialize the display state shared with the render thread
+    displayState.framebufferW = framebufferW;
+    displayState.framebufferH = framebufferH;
+    displayState.contentScaleW = contentScaleW;
+    displayState.contentScaleH = contentScaleH;
+    displayState.mirroredDisplay = mirroredDisplay;
+    displayState.singlePassStereo = singlePassStereo;
+    displayState.profilerEnabled = profilerEnabled;
+    displayState.profilerExport = false;
+    displayState.swapIntervalChanged = false;
+
+
+    //--------------------------------------------------------------------------
+    // START HAPTIC SIMULATION THREAD
+    //--------------------------------------------------------------------------
+
+    // start the clock used to timestamp poses
+    simClock.start(true);
+
+    // create the shared memory telemetry buffer
+    if (telemetryEnabled && !telemetry.open())
+    {
+        cout << "Error: failed to create telemetry buffer " << TELEMETRY_SHM_NAME << endl;
+        telemetryEnabled = false;
+    }
+
+    // create a thread which writes the session log
+    if (!logFile.empty())
+    {
+        if (openSessionLog(logFile))
+        {
+            logRunning = true;
+            logFinished = false;
+            logThread = new cThread();
+            logThread->start(writeSessionLog, CTHREAD_PRIORITY_GRAPHICS);
+        }
+        else
+        {
+            logFile.clear();
+        }
+    }
+
+    // create a thread which exchanges packets with the remote station
+    if (teleopPort > 0)
+    {
+        teleopRunning = true;
+        teleopFinished = false;
+        teleopThread = new cThread();
+        teleopThread->start(runTeleopNetwork, CTHREAD_PRIORITY_GRAPHICS);
+    }
+
+    // create a thread which starts the main haptics rendering loop
+    if (!viewerMode)
+    {
+#ifdef REALTIME_CHECK
+        // backtrace() loads its support library on first use
+        void* frame;
+        backtrace(&frame, 1);
+        cout << "realtime check: reporting allocations, lock acquisitions and waits of the haptic loop" << endl;
+#endif
+        hapticsThread = new cThread();
+        hapticsThread->start(renderHaptics, CTHREAD_PRIORITY_HAPTICS);
+    }
+
+    // create a thread which reloads haptic parameters when the scene file changes
+    if (!sceneFile.empty() && !viewerMode)
+    {
+        watcherRunning = true;
+        watcherFinished = false;
+        watcherThread = new cThread();
+        watcherThread->start(watchHapticParams, CTHREAD_PRIORITY_GRAPHICS);
+    }
+
+    // create a thread which serves the metrics endpoint
+    if (metricsPort > 0)
+    {
+        for (unsigned int i = 0; (i < sceneObjects.size()) && (i < MAX_METRIC_OBJECTS); i++)
+        {
+            metricsObjectNames.push_back(sceneObjects[i].desc.name);
+        }
+        metricsRunning = true;
+        metricsFinished = false;
+        metricsThread = new cThread();
+        metricsThread->start(serveMetrics, CTHREAD_PRIORITY_GRAPHICS);
+    }
+
+    // setup callback when application exits
+    atexit(close);
+
+
+    //--------------------------------------------------------------------------
+    // START GRAPHICS RENDERING THREAD
+    //--------------------------------------------------------------------------
+
+    // release the display context so that the render thread can own it
+    glfwMakeContextCurrent(NULL);
+
+    // create a thread which starts the main graphics rendering loop
+    graphicsRunning = true;
+    graphicsFinished = false;
+    graphicsThread = new cThread();
+    graphicsThread->start(renderGraphicsLoop, CTHREAD_PRIORITY_GRAPHICS);
+
+
+    //--------------------------------------------------------------------------
+    // MAIN EVENT LOOP
+    //--------------------------------------------------------------------------
+
+    // the main thread only processes events, so that input handling never
+    // waits for a frame to complete
+    while (!glfwWindowShouldClose(window))
+    {
+        double traceTime = simClock.getCurrentTimeSeconds();
+        glfwWaitEvents();
+        traceRecord(TRACE_MAIN, "events", traceTime);
+    }
+
+    // stop the render thread and wait for it to release the display context
+    graphicsRunning = false;
+    while (!graphicsFinished) { cSleepMs(10); }
+    delete graphicsThread;
+
+    // write the thread timeline
+    if (!traceFile.empty())
+    {
+        exportTrace(traceFile);
+    }
+
+    // wait for the capture writer to complete
+    if (captureThread != nullptr)
+    {
+        captureRunning = false;
+        while (!captureFinished) { cSleepMs(10); }
+        delete captureThread;
+        captureThread = nullptr;
+
+        if (captureDropped > 0)
+        {
+            cout << "dropped " << captureDropped << " captured frames" << endl;
+        }
+    }
+
+    // close window
+    glfwDestroyWindow(window);
+
+    // terminate GLFW library
+    glfwTerminate();
+
+    // exit
+    return (0);
+}
+
+//------------------------------------------------------------------------------
+
+void onWindowSizeCallback(GLFWwindow* a_window, int a_width, int a_height)
+{
+    // update window size
+    windowW = a_width;
+    windowH = a_height;
+}
+
+//------------------------------------------------------------------------------
+
+void onFrameBufferSizeCallback(GLFWwindow* a_window, int a_width, int a_height)
+{
+    // in offscreen mode, the framebuffer size is set by --size, not by the hidden window
+    if (offscreen) { return; }
+
+    // publish frame buffer size; it is applied by the next frame of the render thread
+    displayStateMutex.acquire();
+    displayState.framebufferW = a_width;
+    displayState.framebufferH = a_height;
+    displayStateMutex.release();
+}
+
+//------------------------------------------------------------------------------
+
+void onWindowContentScaleCallback(GLFWwindow* a_window, float a_xscale, float a_yscale)
+{
+    // publish window content scale factor
+    displayStateMutex.acquire();
+    displayState.contentScaleW = a_xscale;
+    displayState.contentScaleH = a_yscale;
+    displayStateMutex.release();
+}
+
+//------------------------------------------------------------------------------
+
+void onErrorCallback(int a_error, const char* a_description)
+{
+    cout << "Error: " << a_description << endl;
+}
+
+//------------------------------------------------------------------------------
+
+void onKeyCallback(GLFWwindow* a_window, int a_key, int a_scancode, int a_action, int a_mods)
+{
+    // filter calls that only include a key press
+    if ((a_action != GLFW_PRESS) && (a_action != GLFW_REPEAT))
+    {
+        return;
+    }
+
+    // option - exit
+    else if ((a_key == GLFW_KEY_ESCAPE) || (a_key == GLFW_KEY_Q))
+    {
+        glfwSetWindowShouldClose(a_window, GLFW_TRUE);
+    }
+
+    // option - toggle fullscreen
+    else if (a_key == GLFW_KEY_F)
+    {
+        // toggle state variable
+        fullscreen = !fullscreen;
+
+        // get handle to monitor
+        GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+
+        // get information about monitor
+        const GLFWvidmode* mode = glfwGetVideoMode(monitor);
+
+        // set fullscreen or window mode
+        if (fullscreen)
+        {
+            glfwSetWindowMonitor(window, monitor, 0, 0, mode->width, mode->height, mode->refreshRate);
+        }
+        else
+        {
+            int w = 0.8 * mode->height;
+            int h = 0.5 * mode->height;
+            int x = 0.5 * (mode->width - w);
+            int y = 0.5 * (mode->height - h);
+            glfwSetWindowMonitor(window, NULL, x, y, w, h, mode->refreshRate);
+        }
+
+        // set the desired swap interval (applied by the render thread which owns
+        // the display context) and number of samples to use for multisampling
+        displayStateMutex.acquire();
+        displayState.swapIntervalChanged = true;
+        displayStateMutex.release();
+        glfwWindowHint(GLFW_SAMPLES, 4);
+    }
+
+    // option - toggle vertical mirroring
+    else if (a_key == GLFW_KEY_M)
+    {
+        displayStateMutex.acquire();
+        displayState.mirroredDisplay = !displayState.mirroredDisplay;
+        displayStateMutex.release();
+    }
+
+    // option - switch between single-pass and two-pass stereo
+    else if (a_key == GLFW_KEY_S)
+    {
+        if (!modernRenderer ||
+            ((stereoMode != C_STEREO_PASSIVE_LEFT_RIGHT) && (stereoMode != C_STEREO_PASSIVE_TOP_BOTTOM)))
+        {
+            cout << "Error: single-pass stereo requires --gl33 and a passive stereo mode" << endl;
+            return;
+        }
+        displayStateMutex.acquire();
+        displayState.singlePassStereo = !displayState.singlePassStereo;
+        displayStateMutex.release();
+    }
+
+    // option - toggle GPU profiler
+    else if (a_key == GLFW_KEY_P)
+    {
+        if (!profilerSupported)
+        {
+            cout << "Error: the GPU profiler requires GL_ARB_timer_query" << endl;
+            return;
+        }
+        displayStateMutex.acquire();
+        displayState.profilerEnabled = !displayState.profilerEnabled;
+        displayStateMutex.release();
+    }
+
+    // option - export GPU profile
+    else if (a_key == GLFW_KEY_C)
+    {
+        displayStateMutex.acquire();
+        displayState.profilerExport = true;
+        displayStateMutex.release();
+    }
+
+    // option - export thread timeline
+    else if (a_key == GLFW_KEY_T)
+    {
+        exportTrace("trace.json");
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void close(void)
+{
+    // stop the simulation
+    simulationRunning = false;
+    watcherRunning = false;
+    metricsRunning = false;
+
+    // drop pending texture images and wait for the images being decoded
+    textureMutex.acquire();
+    textureJobs.clear();
+    textureMutex.release();
+    while (textureWorkersActive > 0) { cSleepMs(10); }
+    for (unsigned int i = 0; i < textureWorkers.size(); i++)
+    {
+        delete textureWorkers[i];
+    }
+
+    // wait for graphics and haptics loops to terminate
+    while (!simulationFinished) { cSleepMs(100); }
+    while (!watcherFinished) { cSleepMs(100); }
+#ifdef REALTIME_CHECK
+    cout << "realtime check: " << realtimeViolations << " allocations, lock acquisitions and waits during haptic ticks" << endl;
+#endif
+    delete watcherThread;
+    while (!metricsFinished) { cSleepMs(100); }
+    delete metricsThread;
+
+    // stop the teleoperation channel
+    if (teleopThread != nullptr)
+    {
+        teleopRunning = false;
+        while (!teleopFinished) { cSleepMs(10); }
+        delete teleopThread;
+        cout << "teleoperation: " << teleopReceived << " packets received, " << teleopLost << " lost, " <<
+                teleopLate << " late, " << teleopDuplicates << " duplicated, " << teleopUnderruns << " underruns, " <<
+                (teleopOutgoing.dropped + teleopIncoming.dropped) << " dropped" << endl;
+    }
+
+    // hand the last partial chunk to the writer thread and wait for the log to be written
+    if (logThread != nullptr)
+    {
+        uint64_t head = logHead.load(memory_order_relaxed);
+        if ((head - logTail.load(memory_order_acquire) < LOG_POOL) && (logChunks[head % LOG_POOL].count > 0))
+        {
+            logHead.store(head + 1, memory_order_release);
+        }
+        logRunning = false;
+        while (!logFinished) { cSleepMs(10); }
+        delete logThread;
+        delete [] logChunks;
+        if (logDropped > 0)
+        {
+            cout << "dropped " << logDropped << " logged samples" << endl;
+        }
+    }
+
+    // close haptic device
+    if (!viewerMode)
+    {
+        tool->stop();
+    }
+
+    // remove the shared scene state; connected viewers keep their mapping
+    if (shareState)
+    {
+        sceneStateWriter.close();
+        SceneStateWriter::unlink();
+    }
+
+    // close the telemetry buffer; connected monitors keep their mapping
+    if (telemetryEnabled)
+    {
+        telemetry.close();
+        TelemetryWriter::unlink();
+    }
+
+    // delete resources; nodes allocated in the arenas are destroyed with the world,
+    // and their memory is released at once afterwards
+    delete hapticsThread;
+    delete world;
+    delete handler;
+    hapticArena.release();
+    displayArena.release();
+}
+
+//------------------------------------------------------------------------------
+
+
+
+void renderGraphicsLoop(void)
+{
+    // take ownership of the display context
+    glfwMakeContextCurrent(window);
+
+    // set GLFW swap interval for the current display context
+    glfwSwapInterval(swapInterval);
+
+    // a clock to measure the total rendering time
+    cPrecisionClock renderClock;
+    renderClock.start(true);
+    int frameCount = 0;
+
+    // main graphic loop
+    while (graphicsRunning)
+    {
+        // apply the latest input and window state
+        double traceTime = simClock.getCurrentTimeSeconds();
+        consumeDisplayState();
+        traceRecord(TRACE_GRAPHICS, "display state", traceTime);
+
+        // nothing to render while the window is minimized
+        if ((framebufferW == 0) || (framebufferH == 0))
+        {
+            cSleepMs(10);
+            continue;
+        }
+
+        // render graphics
+        renderGraphics();
+
+        // stop after the requested number of frames
+        frameCount++;
+        if ((maxFrames > 0) && (frameCount == maxFrames))
+        {
+            glfwSetWindowShouldClose(window, GLFW_TRUE);
+            glfwPostEmptyEvent();
+        }
+    }
+
+    // report rendering performance
+    double renderTime = renderClock.getCurrentTimeSeconds();
+    if (frameCount > 0)
+    {
+        cout << "rendered " << frameCount << " frames in " << cStr(renderTime, 3) << " s (" <<
+                cStr(1000.0 * renderTime / frameCount, 3) << " ms/frame)" << endl;
+    }
+
+    // release GL resources while the display context is still current
+    if (offscreen)
+    {
+        flushFrameReadbacks();
+        destroyOffscreenBuffer();
+    }
+    setProfilerEnabled(false);
+
+    // release the display context
+    glfwMakeContextCurrent(NULL);
+
+    graphicsFinished = true;
+}
+
+//------------------------------------------------------------------------------
+
+void consumeDisplayState(void)
+{
+    // take a snapshot of the state published by the event thread
+    displayStateMutex.acquire();
+    DisplayState state = displayState;
+    displayState.profilerExport = false;
+    displayState.swapIntervalChanged = false;
+    displayStateMutex.release();
+
+    // apply changes to the scene and display context, all owned by this thread
+    if ((state.framebufferW != framebufferW) || (state.framebufferH != framebufferH))
+    {
+        framebufferW = state.framebufferW;
+        framebufferH = state.framebufferH;
+    }
+
+    viewport->setContentScale(state.contentScaleW, state.contentScaleH);
+
+    if (state.mirroredDisplay != mirroredDisplay)
+    {
+        mirroredDisplay = state.mirroredDisplay;
+        camera->setMirrorVertical(mirroredDisplay);
+    }
+
+    if (state.singlePassStereo != singlePassStereo)
+    {
+        setStereoRendering(state.singlePassStereo);
+    }
+
+    if (state.swapIntervalChanged)
+    {
+        glfwSwapInterval(swapInterval);
+    }
+
+    setProfilerEnabled(state.profilerEnabled);
+
+    if (state.profilerExport)
+    {
+        exportProfilerHistory("profile.csv");
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void renderGraphics(void)
+{
+    // sanity check
+    if (viewport == nullptr) { return; }
+
+    double traceTime = simClock.getCurrentTimeSeconds();
+
+    /////////////////////////////////////////////////////////////////////
+    // UPDATE WIDGETS
+    /////////////////////////////////////////////////////////////////////
+
+    // get width and height of CHAI3D internal rendering buffer
+    int displayW = offscreen ? offscreenW : viewport->getDisplayWidth();
+    int displayH = offscreen ? offscreenH : viewport->getDisplayHeight();
+
+    // in single-pass stereo, the widgets are laid out in the view of one eye
+    if (stereoOverlay->getStereoMode() == C_STEREO_PASSIVE_LEFT_RIGHT) { displayW /= 2; }
+    if (stereoOverlay->getStereoMode() == C_STEREO_PASSIVE_TOP_BOTTOM) { displayH /= 2; }
+
+    // update haptic and graphic rate data
+    labelRates->setText(cStr(freqCounterGraphics.getFrequency(), 0) + " Hz / " +
+                        cStr(freqCounterHaptics.getFrequency(), 0) + " Hz");
+
+    // update position of label
+    labelRates->setLocalPos((int)(0.5 * (displayW - labelRates->getWidth())), 15);
+
+    // update profiler graph
+    updateProfilerWidgets(displayW, displayH);
+    traceTime = traceRecord(TRACE_GRAPHICS, "widgets", traceTime);
+
+
+    /////////////////////////////////////////////////////////////////////
+    // INSTALL TEXTURES
+    /////////////////////////////////////////////////////////////////////
+
+    // images decoded since the last frame are uploaded by this thread
+    installDecodedTextures();
+    traceTime = traceRecord(TRACE_GRAPHICS, "textures", traceTime);
+
+
+    /////////////////////////////////////////////////////////////////////
+    // UPDATE DISPLAY POSES
+    /////////////////////////////////////////////////////////////////////
+
+    // pose the display copies of the moving objects
+    updateDisplayPoses();
+
+    // report events broadcast by the server
+    if (viewerMode)
+    {
+        reportSceneEvents();
+    }
+    traceTime = traceRecord(TRACE_GRAPHICS, "poses", traceTime);
+
+
+    /////////////////////////////////////////////////////////////////////
+    // RENDER SCENE
+    /////////////////////////////////////////////////////////////////////
+
+    // start profiling frame
+    profilerBeginFrame();
+    profilerMark(MARK_FRAME_BEGIN);
+
+    // update shadow maps (if any)
+    world->updateShadowMaps(false, mirroredDisplay);
+    profilerMark(MARK_SHADOWS_END);
+    traceTime = traceRecord(TRACE_GRAPHICS, "shadows", traceTime);
+
+    if (offscreen)
+    {
+        // render world into the offscreen framebuffer
+        glBindFramebuffer(GL_FRAMEBUFFER, offscreenFbo);
+        camera->renderView(offscreenW, offscreenH, 0, 0, C_STEREO_LEFT_EYE, false);
+
+        // start an asynchronous readback instead of waiting for the frame
+        if (captureCount < captureFrames)
+        {
+            queueFrameReadback(captureCount++);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    else
+    {
+        // render world
+        viewport->renderView(framebufferW, framebufferH);
+
+        // wait until all GL commands are completed
+        glFinish();
+    }
+
+    profilerMark(MARK_RENDER_END);
+
+    // check for any OpenGL errors
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) cout << "Error: " << gluErrorString(error) << endl;
+    traceTime = traceRecord(TRACE_GRAPHICS, "render", traceTime);
+
+    // swap buffers
+    if (!offscreen)
+    {
+        glfwSwapBuffers(window);
+    }
+    profilerMark(MARK_SWAP_END);
+    traceRecord(TRACE_GRAPHICS, "swap", traceTime);
+
+    // signal frequency counter
+    freqCounterGraphics.signal(1);
+
+    // publish graphic metrics
+    graphicsMetrics.rate.store(freqCounterGraphics.getFrequency(), memory_order_relaxed);
+    graphicsMetrics.frames.fetch_add(1, memory_order_relaxed);
+}
+
+
+
+void renderHaptics(void)
 {
     simulationRunning = true;
     simulationFinished = false;
 
-    double timeStep = 0.001;
-    double freq = 6.0;             // Hz
-    double amp = 6.0;              // N
+    double timeStep = HAPTIC_TIME_STEP;
+
+    // compute the global frames of the whole scene once; afterwards, only moved
+    // objects are updated
+    world->computeGlobalPositions(true);
+
+    // initialize state of custom behaviors
+    for (unsigned int i = 0; i < behaviorObjects.size(); i++)
+    {
+        SceneObject& object = *behaviorObjects[i];
+        object.startPos = transforms.getPos(object.id);
+        object.velocity.zero();
+        object.time = 0.0;
+        object.inside = false;
+    }
+
+    // telemetry state
+    unsigned int tick = 0;
+    double lastTickTime = simClock.getCurrentTimeSeconds();
+
+    // statistics for the metrics server
+    HapticStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    // teleoperation state
+    uint32_t sendSequence = 0;
+    double lastSendTime = 0.0;
+
+    // state broadcast to viewer processes
+    uint32_t previousContacts = 0;
+    bool previousRemoteActive = false;
+
+    // reserve an interaction event for each object, so that the first contacts
+    // do not grow the event list of the haptic point during a tick
+    tool->m_hapticPoint->m_interactionRecorder.m_interactions.reserve(sceneObjects.size() + 1);
+
+    while (simulationRunning)
+    {
+        beginRealtimeSection();
+
+        // apply parameters reloaded from the scene file
+        double traceTime = simClock.getCurrentTimeSeconds();
+        applyHapticParams();
+        traceTime = traceRecord(TRACE_HAPTICS, "params", traceTime);
+
+        // play out the remote station from the jitter buffer; never waits for the network
+        TeleopPacket remote;
+        bool remoteActive = false;
+        if (teleopPort > 0)
+        {
+            remoteActive = playoutRemoteTool(simClock.getCurrentTimeSeconds(), remote);
+        }
+
+        syncTransforms();
+        tool->updateFromDevice();
+        traceTime = traceRecord(TRACE_HAPTICS, "device", traceTime);
+        tool->computeInteractionForces();
+        traceTime = traceRecord(TRACE_HAPTICS, "interaction", traceTime);
+
+        cVector3d toolPos = tool->getDeviceGlobalPos();
+        cVector3d baseForce = tool->getDeviceGlobalForce(); // base haptic feedback
+
+        // haptic textures of the objects in contact, modulating the contact force
+        if (!texturedObjects.empty())
+        {
+            cVector3d contactForce = baseForce;
+            cVector3d toolVel = tool->getDeviceGlobalLinVel();
+            for (unsigned int i = 0; i < texturedObjects.size(); i++)
+            {
+                if (tool->m_hapticPoint->isInContact(texturedObjects[i]->shape))
+                {
+                    baseForce += computeTextureForce(*texturedObjects[i], toolPos, toolVel, contactForce);
+                }
+            }
+            traceTime = traceRecord(TRACE_HAPTICS, "textures", traceTime);
+        }
+
+        // viscosity field
+        if (!fieldFile.empty())
+        {
+            baseForce += sampleViscosityField(viscosityField, toolPos, tool->getDeviceGlobalLinVel());
+        }
+
+        // custom behaviors, evaluated in scene order
+        for (unsigned int i = 0; i < behaviorObjects.size(); i++)
+        {
+            SceneObject& object = *behaviorObjects[i];
+            const SceneObjectDesc& desc = object.desc;
+            cVector3d dir = transforms.getPos(object.id) - toolPos;
+            double dist = dir.length();
+            double radius = transforms.radius[object.id];
+
+            // --- damping inside the object ---
+            if (desc.behavior == BEHAVIOR_DAMPING)
+            {
+                if (dist < desc.margin + radius)
+                {
+                    // read linear velocity
+                    cVector3d linearVelocity = tool->getDeviceGlobalLinVel();
+
+                    // compute linear damping force
+                    cVector3d forceDamping = desc.damping * linearVelocity;
+                    baseForce.add(forceDamping);
+                    baseForce *= desc.gain;
+                }
+            }
+
+            // --- oscillating force; once entered, the region doubles in size ---
+            else if (desc.behavior == BEHAVIOR_OSCILLATOR)
+            {
+                double radiusSum = object.inside ?
+                    desc.margin + radius * 2 :
+                    desc.margin + radius;
+
+                if (dist < radiusSum)
+                {
+                    // the pattern is compiled into one force sample per tick
+                    object.time += timeStep;
+                    int sample = (int)(object.time / timeStep + 0.5) % object.waveformLength;
+                    const float* force = object.waveform + 3 * sample;
+                    baseForce += desc.amplitude * cVector3d(force[0], force[1], force[2]);
+
+                    object.inside = true;
+                }
+                else
+                {
+                    object.time = 0.0;
+                    object.inside = false;
+                }
+            }
+
+            // --- object pushed by the tool ---
+            else if (desc.behavior == BEHAVIOR_DYNAMIC)
+            {
+                if (dist < desc.margin + radius)
+                {
+                    cVector3d netForce = -baseForce - desc.damping * object.velocity;
+                    object.velocity += (netForce / desc.mass) * timeStep;
+                    baseForce *= desc.gain;
+                }
+
+                cVector3d pos = transforms.getPos(object.id) + object.velocity * timeStep;
+                object.velocity *= 0.999;
+
+                if ((pos - object.startPos).length() > desc.range)
+                {
+                    object.velocity.set(0, 0, 0);
+                    pos = object.startPos;
+                }
+                transforms.setPos(object.id, pos);
+            }
+        }
+
+        // couple the local tool with the remote tool through wave variables
+        TeleopArrival outgoing;
+        if (teleopPort > 0)
+        {
+            double dt = cClamp(simClock.getCurrentTimeSeconds() - lastTickTime, 0.0, 0.002);
+            baseForce += computeWaveCoupling(remote, remoteActive, toolPos, tool->getDeviceGlobalLinVel(),
+                                             dt, outgoing.packet);
+        }
+
+        traceTime = traceRecord(TRACE_HAPTICS, "behaviors", traceTime);
+
+        tool->setDeviceGlobalForce(baseForce);
+        tool->applyToDevice();
+        traceTime = traceRecord(TRACE_HAPTICS, "apply", traceTime);
+
+        // stream the tool to the remote station
+        if (teleopPort > 0)
+        {
+            double now = simClock.getCurrentTimeSeconds();
+            if (now - lastSendTime >= TELEOP_SEND_PERIOD)
+            {
+                outgoing.packet.magic = TELEOP_MAGIC;
+                outgoing.packet.sequence = sendSequence++;
+                outgoing.packet.time = now;
+                for (int i = 0; i < 3; i++)
+                {
+                    outgoing.packet.position[i] = (float)toolPos(i);
+                    outgoing.packet.force[i] = (float)baseForce(i);
+                }
+                outgoing.arrival = now;
+                teleopOutgoing.push(outgoing);
+                lastSendTime = now;
+            }
+        }
+
+        // publish timestamped poses for the graphic thread
+        PoseData pose;
+        pose.time = simClock.getCurrentTimeSeconds();
+        pose.toolPos = tool->m_hapticPoint->getGlobalPosProxy();
+        for (unsigned int i = 0; i < behaviorObjects.size(); i++)
+        {
+            if (behaviorObjects[i]->poseIndex >= 0)
+            {
+                pose.objectPos[behaviorObjects[i]->poseIndex] = transforms.getPos(behaviorObjects[i]->id);
+            }
+        }
+        pose.remoteToolPos = remoteProxyPos;
+        pose.remoteToolActive = remoteActive;
+        publishPoses(pose);
+
+        // publish telemetry for external monitors
+        if (telemetryEnabled)
+        {
+            TelemetrySample sample;
+            sample.time = pose.time;
+            sample.loopTime = pose.time - lastTickTime;
+            for (int i = 0; i < 3; i++)
+            {
+                sample.position[i] = (float)toolPos(i);
+                sample.force[i] = (float)baseForce(i);
+            }
+            sample.contacts = tool->m_hapticPoint->getNumInteractionEvents();
+            sample.tick = tick;
+            telemetry.write(sample);
+        }
+        // update statistics for the metrics server
+        uint32_t contacts = ((metricsPort > 0) || !logFile.empty() || shareState) ? computeContactMask() : 0;
+        if (metricsPort > 0)
+        {
+            updateHapticStats(stats, pose.time - lastTickTime, timeStep, baseForce, contacts);
+            if (stats.ticks % METRICS_PUBLISH_TICKS == 0)
+            {
+                publishHapticMetrics(stats);
+            }
+        }
+
+        // record the sample in the session log
+        if (!logFile.empty())
+        {
+            logSample(pose, toolPos, baseForce, contacts);
+        }
+
+        // broadcast contact and connection changes to viewer processes
+        if (shareState)
+        {
+            uint32_t changed = contacts ^ previousContacts;
+            for (int i = 0; changed != 0; i++, changed >>= 1)
+            {
+                if (changed & 1)
+                {
+                    sceneStateWriter.publishEvent(pose.time, (contacts & (1u << i)) ?
+                        SCENE_EVENT_CONTACT_BEGIN : SCENE_EVENT_CONTACT_END, i);
+                }
+            }
+            if (remoteActive != previousRemoteActive)
+            {
+                sceneStateWriter.publishEvent(pose.time, remoteActive ?
+                    SCENE_EVENT_REMOTE_CONNECTED : SCENE_EVENT_REMOTE_DISCONNECTED, -1);
+            }
+        }
+        previousContacts = contacts;
+        previousRemoteActive = remoteActive;
+
+        lastTickTime = pose.time;
+        tick++;
+        traceRecord(TRACE_HAPTICS, "publish", traceTime);
+
+        freqCounterHaptics.signal(1);
+
+        endRealtimeSection();
+    }
+
+    simulationFinished = true;
+}
+
+//------------------------------------------------------------------------------
+
+void publishPoses(const PoseData& a_pose)
+{
+    // single writer: only the haptic thread publishes poses
+    unsigned int count = poseHistoryCount.load(memory_order_relaxed);
+    PoseSlot& slot = poseHistory[count % POSE_HISTORY];
+
+    unsigned int sequence = slot.sequence.load(memory_order_relaxed);
+    slot.sequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot.data = a_pose;
+    slot.sequence.store(sequence + 2, memory_order_release);
+
+    poseHistoryCount.store(count + 1, memory_order_release);
+
+    // share the pose with viewer processes
+    if (shareState)
+    {
+        SharedPose shared;
+        shared.time = a_pose.time;
+        shared.remoteToolActive = a_pose.remoteToolActive ? 1 : 0;
+        shared.numObjects = numDynamicObjects;
+        for (int j = 0; j < 3; j++)
+        {
+            shared.toolPos[j] = a_pose.toolPos(j);
+            shared.remoteToolPos[j] = a_pose.remoteToolPos(j);
+            for (int i = 0; i < numDynamicObjects; i++)
+            {
+                shared.objectPos[i][j] = a_pose.objectPos[i](j);
+            }
+        }
+        sceneStateWriter.publishPose(shared);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool readPoseSample(unsigned int a_index, PoseData& a_pose)
+{
+    // a viewer reads the poses shared by the server
+    if (viewerMode)
+    {
+        SharedPose shared;
+        if (!sceneStateReader.readPose(a_index, shared)) { return (false); }
+        a_pose.time = shared.time;
+        a_pose.toolPos.set(shared.toolPos[0], shared.toolPos[1], shared.toolPos[2]);
+        a_pose.remoteToolPos.set(shared.remoteToolPos[0], shared.remoteToolPos[1], shared.remoteToolPos[2]);
+        a_pose.remoteToolActive = (shared.remoteToolActive != 0);
+        for (int i = 0; i < numDynamicObjects; i++)
+        {
+            a_pose.objectPos[i].set(shared.objectPos[i][0], shared.objectPos[i][1], shared.objectPos[i][2]);
+        }
+        return (true);
+    }
+
+    const PoseSlot& slot = poseHistory[a_index % POSE_HISTORY];
+
+    // retry if the haptic thread is writing the slot; never wait for it
+    for (int attempt = 0; attempt < 4; attempt++)
+    {
+        unsigned int sequence = slot.sequence.load(memory_order_acquire);
+        if (sequence & 1) { continue; }
+        a_pose = slot.data;
+        atomic_thread_fence(memory_order_acquire);
+        if (slot.sequence.load(memory_order_relaxed) == sequence) { return (true); }
+    }
+    return (false);
+}
+
+//------------------------------------------------------------------------------
+
+bool samplePoses(double a_latency, PoseData& a_pose)
+{
+    unsigned int count = viewerMode ? (unsigned int)sceneStateReader.getPoseCount() :
+                                      poseHistoryCount.load(memory_order_acquire);
+    if (count < 2) { return (false); }
+
+    // read the latest two samples
+    PoseData newer, older;
+    if (!readPoseSample(count - 1, newer) || !readPoseSample(count - 2, older)) { return (false); }
+
+    // the requested time trails the latest sample, so it is bracketed by two
+    // samples and never extrapolated; it is expressed in the clock of the samples,
+    // which lets a viewer use the server poses without mapping its own clock
+    double time = newer.time - cMax(a_latency, 0.0);
+
+    // walk back through the history to the samples that bracket the requested time;
+    // the oldest half of the ring is left alone since the writer may be reusing it
+    unsigned int index = count - 2;
+    unsigned int oldest = (count > POSE_HISTORY / 2) ? count - POSE_HISTORY / 2 : 0;
+    while ((older.time > time) && (index > oldest))
+    {
+        newer = older;
+        index--;
+        if (!readPoseSample(index, older)) { return (false); }
+    }
+
+    // interpolate between the bracketing samples
+    double dt = newer.time - older.time;
+    double t = (dt > 0.0) ? cClamp((time - older.time) / dt, 0.0, 1.0) : 1.0;
+    a_pose.time = time;
+    a_pose.toolPos = older.toolPos + t * (newer.toolPos - older.toolPos);
+    for (int i = 0; i < numDynamicObjects; i++)
+    {
+        a_pose.objectPos[i] = older.objectPos[i] + t * (newer.objectPos[i] - older.objectPos[i]);
+    }
+    a_pose.remoteToolPos = older.remoteToolPos + t * (newer.remoteToolPos - older.remoteToolPos);
+    a_pose.remoteToolActive = newer.remoteToolActive;
+    return (true);
+}
+
+//------------------------------------------------------------------------------
+
+void updateDisplayPoses(void)
+{
+    // render one frame period behind the latest haptic sample: the pose is then
+    // interpolated between two measured samples and moves smoothly, at the cost
+    // of a constant delay of one frame
+    double graphicRate = freqCounterGraphics.getFrequency();
+    double framePeriod = (graphicRate > 1.0) ? 1.0 / graphicRate : 1.0 / 60.0;
+    double latency = cMax(framePeriod, minPoseLatency);
+
+    PoseData pose;
+    if (samplePoses(latency, pose))
+    {
+        toolDisplay->setLocalPos(pose.toolPos);
+        for (unsigned int i = 0; i < behaviorObjects.size(); i++)
+        {
+            if (behaviorObjects[i]->poseIndex >= 0)
+            {
+                behaviorObjects[i]->display->setLocalPos(pose.objectPos[behaviorObjects[i]->poseIndex]);
+            }
+        }
+        if (remoteToolDisplay != nullptr)
+        {
+            remoteToolDisplay->setEnabled(pose.remoteToolActive);
+            remoteToolDisplay->setLocalPos(pose.remoteToolPos);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool validateSceneObject(const SceneObjectDesc& a_desc, string& a_error)
+{
+    // strings are used as C strings, so they must end within their field
+    const char* strings[] = { a_desc.name, a_desc.texture, a_desc.pattern, a_desc.heightMap, a_desc.frictionMap };
+    const size_t sizes[] = { sizeof(a_desc.name), sizeof(a_desc.texture), sizeof(a_desc.pattern),
+                             sizeof(a_desc.heightMap), sizeof(a_desc.frictionMap) };
+    for (int i = 0; i < 5; i++)
+    {
+        if (memchr(strings[i], 0, sizes[i]) == NULL)
+        {
+            a_error = "unterminated string";
+            return (false);
+        }
+    }
+
+    const uint32_t effects = EFFECT_SURFACE | EFFECT_MAGNETIC | EFFECT_VISCOSITY | EFFECT_STICK_SLIP | EFFECT_VIBRATION;
+    const uint32_t flags = FLAG_IN_WORLD | FLAG_USE_TEXTURE | FLAG_SPHERICAL_MAPPING | FLAG_ABSOLUTE_STIFFNESS;
+    const uint32_t params = PARAM_STIFFNESS | PARAM_VISCOSITY | PARAM_MAGNET_MAX_FORCE | PARAM_MAGNET_MAX_DISTANCE |
+                            PARAM_STICK_SLIP_FORCE_MAX | PARAM_STICK_SLIP_STIFFNESS | PARAM_VIBRATION_FREQUENCY |
+                            PARAM_VIBRATION_AMPLITUDE;
+    if (a_desc.behavior > BEHAVIOR_DYNAMIC)
+    {
+        a_error = "unknown behavior";
+        return (false);
+    }
+    if ((a_desc.effects & ~effects) != 0)
+    {
+        a_error = "unknown effect";
+        return (false);
+    }
+    if ((a_desc.flags & ~flags) != 0)
+    {
+        a_error = "unknown flag";
+        return (false);
+    }
+    if ((a_desc.specified & ~params) != 0)
+    {
+        a_error = "unknown material property";
+        return (false);
+    }
+
+    // non-finite values would reach the geometry, the transform table and the device force
+    const float values[] = { a_desc.position[0], a_desc.position[1], a_desc.position[2], a_desc.radius,
+                             a_desc.stiffness, a_desc.viscosity, a_desc.magnetMaxForce, a_desc.magnetMaxDistance,
+                             a_desc.stickSlipForceMax, a_desc.stickSlipStiffness, a_desc.vibrationFrequency,
+                             a_desc.vibrationAmplitude, a_desc.margin, a_desc.gain, a_desc.damping, a_desc.frequency,
+                             a_desc.amplitude, a_desc.mass, a_desc.range, a_desc.patternLoop, a_desc.bumpDepth,
+                             a_desc.friction };
+    for (unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        if (!isfinite(values[i]))
+        {
+            a_error = "non-finite value";
+            return (false);
+        }
+    }
+    if (a_desc.radius <= 0.0f)
+    {
+        a_error = "radius must be positive";
+        return (false);
+    }
+
+    // the negated comparison also rejects a NaN mass
+    if ((a_desc.behavior == BEHAVIOR_DYNAMIC) && !(a_desc.mass > 0.0f))
+    {
+        a_error = "mass must be positive";
+        return (false);
+    }
+
+    vector<WaveVoice> voices;
+    if ((a_desc.pattern[0] != 0) && !parseWaveform(a_desc.pattern, voices))
+    {
+        a_error = "invalid pattern";
+        return (false);
+    }
+
+    return (true);
+}
+
+//------------------------------------------------------------------------------
+
+bool parseScene(const char* a_text, size_t a_length, vector<SceneObjectDesc>& a_descs)
+{
+    const char* end = a_text + a_length;
+    const char* line = a_text;
+    int lineNumber = 0;
+
+    while (line < end)
+    {
+        const char* lineEnd = (const char*)memchr(line, '\n', end - line);
+        if (lineEnd == NULL) { lineEnd = end; }
+        lineNumber++;
+
+        // split line into whitespace-separated tokens
+        string text(line, lineEnd - line);
+        line = lineEnd + 1;
+        size_t comment = text.find('#');
+        if (comment != string::npos) { text.erase(comment); }
+
+        vector<string> tokens;
+        size_t pos = 0;
+        while (pos < text.size())
+        {
+            size_t start = text.find_first_not_of(" \t\r", pos);
+            if (start == string::npos) { break; }
+            size_t stop = text.find_first_of(" \t\r", start);
+            if (stop == string::npos) { stop = text.size(); }
+            tokens.push_back(text.substr(start, stop - start));
+            pos = stop;
+        }
+        if (tokens.empty()) { continue; }
+
+        if ((tokens[0] != "sphere") || (tokens.size() < 2))
+        {
+            cout << "Error: scene line " << lineNumber << ": expected 'sphere <name>'" << endl;
+            return (false);
+        }
+
+        // default values
+        SceneObjectDesc desc;
+        memset(&desc, 0, sizeof(desc));
+        strncpy(desc.name, tokens[1].c_str(), sizeof(desc.name) - 1);
+        desc.radius = 0.1f;
+        desc.flags = FLAG_IN_WORLD | FLAG_SPHERICAL_MAPPING;
+        desc.gain = 1.0f;
+        desc.mass = 1.0f;
+        desc.range = 1.0f;
+
+        for (unsigned int i = 2; i < tokens.size(); i++)
+        {
+            const string& token = tokens[i];
+            size_t equal = token.find('=');
+            string key = token.substr(0, equal);
+            const char* value = (equal != string::npos) ? token.c_str() + equal + 1 : "";
+
+            // the value of a numeric key must be a number and nothing else
+            char* numberEnd;
+            float number = (float)strtod(value, &numberEnd);
+            const string* keysEnd = numericSceneKeys + NUM_NUMERIC_SCENE_KEYS;
+            bool numeric = (find(numericSceneKeys, keysEnd, key) != keysEnd);
+            if (numeric && ((numberEnd == value) || (*numberEnd != 0)))
+            {
+                cout << "Error: scene line " << lineNumber << ": invalid value of " << key << endl;
+                return (false);
+            }
+
+            if (key == "hidden")                    { desc.flags &= ~FLAG_IN_WORLD; }
+            else if (key == "usetexture")           { desc.flags |= FLAG_USE_TEXTURE; }
+            else if (key == "nospheremap")          { desc.flags &= ~FLAG_SPHERICAL_MAPPING; }
+            else if (key == "texture")              { strncpy(desc.texture, value, sizeof(desc.texture) - 1); }
+            else if (key == "radius")               { desc.radius = number; }
+            else if (key == "pos")
+            {
+                int length = 0;
+                if ((sscanf(value, "%f,%f,%f%n", &desc.position[0], &desc.position[1], &desc.position[2], &length) != 3) ||
+                    (value[length] != 0))
+                {
+                    cout << "Error: scene line " << lineNumber << ": invalid position" << endl;
+                    return (false);
+                }
+            }
+            else if (key == "stiffness")            { desc.stiffness = number; desc.specified |= PARAM_STIFFNESS; }
+            else if (key == "stiffnessabs")         { desc.stiffness = number; desc.specified |= PARAM_STIFFNESS; desc.flags |= FLAG_ABSOLUTE_STIFFNESS; }
+            else if (key == "viscosity")            { desc.viscosity = number; desc.specified |= PARAM_VISCOSITY; }
+            else if (key == "magnetforce")          { desc.magnetMaxForce = number; desc.specified |= PARAM_MAGNET_MAX_FORCE; }
+            else if (key == "magnetdistance")       { desc.magnetMaxDistance = number; desc.specified |= PARAM_MAGNET_MAX_DISTANCE; }
+            else if (key == "stickslipforce")       { desc.stickSlipForceMax = number; desc.specified |= PARAM_STICK_SLIP_FORCE_MAX; }
+            else if (key == "stickslipstiffness")   { desc.stickSlipStiffness = number; desc.specified |= PARAM_STICK_SLIP_STIFFNESS; }
+            else if (key == "vibrationfreq")        { desc.vibrationFrequency = number; desc.specified |= PARAM_VIBRATION_FREQUENCY; }
+            else if (key == "vibrationamp")         { desc.vibrationAmplitude = number; desc.specified |= PARAM_VIBRATION_AMPLITUDE; }
+            else if (key == "margin")               { desc.margin = number; }
+            else if (key == "gain")                 { desc.gain = number; }
+            else if (key == "damping")              { desc.damping = number; }
+            else if (key == "frequency")            { desc.frequency = number; }
+            else if (key == "amplitude")            { desc.amplitude = number; }
+            else if (key == "mass")                 { desc.mass = number; }
+            else if (key == "range")                { desc.range = number; }
+            else if (key == "patternloop")          { desc.patternLoop = number; }
+            else if (key == "heightmap")            { strncpy(desc.heightMap, value, sizeof(desc.heightMap) - 1); }
+            else if (key == "frictionmap")          { strncpy(desc.frictionMap, value, sizeof(desc.frictionMap) - 1); }
+            else if (key == "bumpdepth")            { desc.bumpDepth = number; }
+            else if (key == "friction")             { desc.friction = number; }
+            else if (key == "pattern")
+            {
+                vector<WaveVoice> voices;
+                if ((strlen(value) >= sizeof(desc.pattern)) || !parseWaveform(value, voices))
+                {
+                    cout << "Error: scene line " << lineNumber << ": invalid pattern" << endl;
+                    return (false);
+                }
+                strncpy(desc.pattern, value, sizeof(desc.pattern) - 1);
+            }
+            else if (key == "behavior")
+            {
+                string behavior = value;
+                if (behavior == "damping")          { desc.behavior = BEHAVIOR_DAMPING; }
+                else if (behavior == "oscillator")  { desc.behavior = BEHAVIOR_OSCILLATOR; }
+                else if (behavior == "dynamic")     { desc.behavior = BEHAVIOR_DYNAMIC; }
+                else
+                {
+                    cout << "Error: scene line " << lineNumber << ": unknown behavior " << behavior << endl;
+                    return (false);
+                }
+            }
+            else if (key == "effects")
+            {
+                string effects = string(value) + ",";
+                size_t start = 0;
+                size_t comma;
+                while ((comma = effects.find(',', start)) != string::npos)
+                {
+                    string effect = effects.substr(start, comma - start);
+                    start = comma + 1;
+                    if (effect == "surface")         { desc.effects |= EFFECT_SURFACE; }
+                    else if (effect == "magnetic")   { desc.effects |= EFFECT_MAGNETIC; }
+                    else if (effect == "viscosity")  { desc.effects |= EFFECT_VISCOSITY; }
+                    else if (effect == "stickslip")  { desc.effects |= EFFECT_STICK_SLIP; }
+                    else if (effect == "vibration")  { desc.effects |= EFFECT_VIBRATION; }
+                    else if (!effect.empty())
+                    {
+                        cout << "Error: scene line " << lineNumber << ": unknown effect " << effect << endl;
+                        return (false);
+                    }
+                }
+            }
+            else
+            {
+                cout << "Error: scene line " << lineNumber << ": unknown key " << key << endl;
+                return (false);
+            }
+        }
+
+        string error;
+        if (!validateSceneObject(desc, error))
+        {
+            cout << "Error: scene line " << lineNumber << ": " << error << endl;
+            return (false);
+        }
+
+        a_descs.push_back(desc);
+    }
+
+    return (true);
+}
+
+//------------------------------------------------------------------------------
+
+bool loadScene(const string& a_filename, vector<SceneObjectDesc>& a_descs)
+{
+#ifndef _WIN32
+    // map the file; binary scenes are then used in place without parsing
+    int fd = open(a_filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        cout << "Error: cannot open " << a_filename << endl;
+        return (false);
+    }
+    struct stat info;
+    fstat(fd, &info);
+    size_t size = (size_t)info.st_size;
+    const char* data = (size > 0) ? (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    ::close(fd);
+    if ((size > 0) && (data == (const char*)MAP_FAILED))
+    {
+        cout << "Error: cannot map " << a_filename << endl;
+        return (false);
+    }
+#else
+    FILE* file = fopen(a_filename.c_str(), "rb");
+    if (file == NULL)
+    {
+        cout << "Error: cannot open " << a_filename << endl;
+        return (false);
+    }
+    fseek(file, 0, SEEK_END);
+    size_t size = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    vector<char> buffer(size + 1);
+    size = fread(&buffer[0], 1, size, file);
+    fclose(file);
+    const char* data = &buffer[0];
+#endif
+
+    bool result;
+    const SceneFileHeader* header = (const SceneFileHeader*)data;
+    if ((size >= sizeof(SceneFileHeader)) && (memcmp(header->magic, "CSCN", 4) == 0))
+    {
+        // binary scene: records follow the header
+        result = (header->version == SCENE_FILE_VERSION) && (header->recordSize == sizeof(SceneObjectDesc)) &&
+                 (size >= sizeof(SceneFileHeader) + (size_t)header->count * sizeof(SceneObjectDesc));
+        if (result)
+        {
+            // records are checked like the objects of a text scene
+            const SceneObjectDesc* records = (const SceneObjectDesc*)(data + sizeof(SceneFileHeader));
+            string error;
+            for (uint32_t i = 0; result && (i < header->count); i++)
+            {
+                result = validateSceneObject(records[i], error);
+                if (!result)
+                {
+                    cout << "Error: " << a_filename << " record " << i << ": " << error << endl;
+                }
+            }
+            if (result)
+            {
+                a_descs.assign(records, records + header->count);
+            }
+        }
+        else
+        {
+            cout << "Error: " << a_filename << " is not a compatible binary scene" << endl;
+        }
+    }
+    else
+    {
+        // text scene
+        result = parseScene(data, size, a_descs);
+    }
+
+#ifndef _WIN32
+    if (size > 0) { munmap((void*)data, size); }
+#endif
+
+    return (result);
+}
+
+//------------------------------------------------------------------------------
+
+bool saveSceneBinary(const string& a_filename, const vector<SceneObjectDesc>& a_descs)
+{
+    FILE* file = fopen(a_filename.c_str(), "wb");
+    if (file == NULL)
+    {
+        cout << "Error: cannot create " << a_filename << endl;
+        return (false);
+    }
+
+    SceneFileHeader header;
+    memcpy(header.magic, "CSCN", 4);
+    header.version = SCENE_FILE_VERSION;
+    header.count = (uint32_t)a_descs.size();
+    header.recordSize = sizeof(SceneObjectDesc);
+
+    bool result = (fwrite(&header, sizeof(header), 1, file) == 1);
+    if (result && !a_descs.empty())
+    {
+        result = (fwrite(&a_descs[0], sizeof(SceneObjectDesc), a_descs.size(), file) == a_descs.size());
+    }
+    fclose(file);
+
+    return (result);
+}
+
+//------------------------------------------------------------------------------
+
+void buildScene(const vector<SceneObjectDesc>& a_descs, double a_maxLinearForce,
+                double a_maxStiffness, double a_maxDamping)
+{
+    sceneObjects.resize(a_descs.size());
+    for (unsigned int i = 0; i < a_descs.size(); i++)
+    {
+        const SceneObjectDesc& desc = a_descs[i];
+        SceneObject& object = sceneObjects[i];
+        object.desc = desc;
+        object.id = i;
+        object.poseIndex = -1;
+
+        // create a sphere and define its radius; the sphere, its material and its
+        // effects are allocated next to each other
+        cMaterialPtr material = allocate_shared<cMaterial>(ArenaAllocator<cMaterial>(hapticArena));
+        cShapeSphere* shape = new (hapticArena) ArenaNode<cShapeSphere>(desc.radius, material);
+        object.shape = shape;
+        object.display = shape;
+
+        // add object to world
+        if (desc.flags & FLAG_IN_WORLD)
+        {
+            world->addChild(shape);
+        }
+
+        // set the position of the object
+        shape->setLocalPos(desc.position[0], desc.position[1], desc.position[2]);
+
+        // load texture map; objects using the same image share one texture
+        bool sphericalMapping = (desc.flags & FLAG_SPHERICAL_MAPPING) != 0;
+        if ((desc.texture[0] != 0) && (desc.flags & FLAG_IN_WORLD))
+        {
+            shape->m_texture = getSharedTexture(desc.texture, sphericalMapping);
+        }
+        else
+        {
+            shape->m_texture = cTexture2d::create();
+            shape->m_texture->setSphericalMappingEnabled(sphericalMapping);
+        }
+
+        // set graphic properties
+        shape->m_material->setGray();
+        if (desc.flags & FLAG_USE_TEXTURE)
+        {
+            shape->setUseTexture(true);
+        }
+
+        // set haptic properties given by the scene, including zeros
+        uint32_t given = desc.specified;
+        if (given & PARAM_STIFFNESS)
+        {
+            bool absolute = (desc.flags & FLAG_ABSOLUTE_STIFFNESS) != 0;
+            shape->m_material->setStiffness(absolute ? desc.stiffness : desc.stiffness * a_maxStiffness);
+        }
+        if (given & PARAM_VISCOSITY)              { shape->m_material->setViscosity(desc.viscosity * a_maxDamping); }
+        if (given & PARAM_MAGNET_MAX_FORCE)       { shape->m_material->setMagnetMaxForce(desc.magnetMaxForce * a_maxLinearForce); }
+        if (given & PARAM_MAGNET_MAX_DISTANCE)    { shape->m_material->setMagnetMaxDistance(desc.magnetMaxDistance); }
+        if (given & PARAM_STICK_SLIP_FORCE_MAX)   { shape->m_material->setStickSlipForceMax(desc.stickSlipForceMax * a_maxLinearForce); }
+        if (given & PARAM_STICK_SLIP_STIFFNESS)   { shape->m_material->setStickSlipStiffness(desc.stickSlipStiffness * a_maxStiffness); }
+        if (given & PARAM_VIBRATION_FREQUENCY)    { shape->m_material->setVibrationFrequency(desc.vibrationFrequency); }
+        if (given & PARAM_VIBRATION_AMPLITUDE)    { shape->m_material->setVibrationAmplitude(desc.vibrationAmplitude * a_maxLinearForce); }
+
+        // create haptic effects; the surface is rendered by the proxy, and the other
+        // effects are fused into a single effect unless stock effects are requested
+        uint32_t fused = desc.effects & (EFFECT_VIBRATION | EFFECT_VISCOSITY | EFFECT_MAGNETIC | EFFECT_STICK_SLIP);
+        if (desc.effects & EFFECT_SURFACE)    { shape->createEffectSurface(); }
+        if (stockEffects)
+        {
+            if (fused & EFFECT_VIBRATION)     { shape->createEffectVibration(); }
+            if (fused & EFFECT_VISCOSITY)     { shape->createEffectViscosity(); }
+            if (fused & EFFECT_MAGNETIC)      { shape->createEffectMagnetic(); }
+            if (fused & EFFECT_STICK_SLIP)    { shape->createEffectStickSlip(); }
+        }
+        else if (runtimeEffects && (fused != 0))
+        {
+            shape->addEffect(new (hapticArena) FusedEffect(shape, fused));
+        }
+        else if (fused != 0)
+        {
+            shape->addEffect(createEffectKernel(shape, fused, hapticArena));
+        }
+
+        // dynamic objects are moved by the haptic thread; they are displayed by a
+        // copy that shares their material and texture and is posed by the graphic thread
+        if ((desc.behavior == BEHAVIOR_DYNAMIC) && (numDynamicObjects < MAX_DYNAMIC_OBJECTS))
+        {
+            object.poseIndex = numDynamicObjects++;
+            shape->setShowEnabled(false);
+            object.display = new (displayArena) ArenaNode<cShapeSphere>(desc.radius);
+            if (desc.flags & FLAG_IN_WORLD)
+            {
+                world->addChild(object.display);
+            }
+            object.display->setLocalPos(shape->getLocalPos());
+            object.display->m_material = shape->m_material;
+            object.display->m_texture = shape->m_texture;
+            object.display->setUseTexture((desc.flags & FLAG_USE_TEXTURE) != 0);
+            object.display->setHapticEnabled(false);
+        }
+
+        // compile the force pattern of oscillators
+        object.waveform = NULL;
+        object.waveformLength = 0;
+        if (desc.behavior == BEHAVIOR_OSCILLATOR)
+        {
+            object.waveformTable = make_shared<vector<float> >();
+            if (!compileWaveform(desc, HAPTIC_TIME_STEP, *object.waveformTable))
+            {
+                cout << "Error: cannot compile the pattern of object " << desc.name << endl;
+                object.waveformTable->assign(3, 0.0f);
+            }
+            object.waveform = &(*object.waveformTable)[0];
+            object.waveformLength = (int)object.waveformTable->size() / 3;
+        }
+
+        // select the mipmap level whose texels are about half the size of the tool,
+        // measured along the equator; finer features cannot be felt
+        object.texels = NULL;
+        if (desc.heightMap[0] != 0)
+        {
+            object.hapticTexture = getHapticTexture(desc.heightMap, desc.frictionMap);
+            if (object.hapticTexture)
+            {
+                const HapticTexture& texture = *object.hapticTexture;
+                int level = 0;
+                while ((level + 1 < (int)texture.levels.size()) &&
+                       (2.0 * C_PI * desc.radius / texture.widths[level] < 0.5 * tool->getRadius()))
+                {
+                    level++;
+                }
+                object.texels = &texture.levels[level][0];
+                object.texelWidth = texture.widths[level];
+                object.texelHeight = texture.heights[level];
+            }
+        }
+    }
+
+    // fill the transform table; moved ids never exceed the number of objects
+    transforms.x.resize(sceneObjects.size());
+    transforms.y.resize(sceneObjects.size());
+    transforms.z.resize(sceneObjects.size());
+    transforms.radius.resize(sceneObjects.size());
+    transforms.moved.assign(sceneObjects.size(), 0);
+    transforms.movedIds.reserve(sceneObjects.size());
+    for (unsigned int i = 0; i < sceneObjects.size(); i++)
+    {
+        cVector3d pos = sceneObjects[i].shape->getLocalPos();
+        transforms.x[i] = pos(0);
+        transforms.y[i] = pos(1);
+        transforms.z[i] = pos(2);
+        transforms.radius[i] = sceneObjects[i].desc.radius;
+    }
+
+    // allocate parameter buffers so that applying parameters never allocates memory
+    for (int i = 0; i < 3; i++)
+    {
+        paramBuffers[i].resize(sceneObjects.size());
+    }
+    reloadedDescs = a_descs;
+
+    // objects with custom behaviors or textures, in scene order; the vector is not
+    // resized afterwards, so the pointers remain valid
+    for (unsigned int i = 0; i < sceneObjects.size(); i++)
+    {
+        if (sceneObjects[i].desc.behavior != BEHAVIOR_NONE)
+        {
+            behaviorObjects.push_back(&sceneObjects[i]);
+        }
+        if (sceneObjects[i].texels != NULL)
+        {
+            texturedObjects.push_back(&sceneObjects[i]);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool parseWaveform(const char* a_pattern, vector<WaveVoice>& a_voices)
+{
+    a_voices.clear();
+
+    string pattern = string(a_pattern) + "|";
+    size_t start = 0;
+    size_t bar;
+    while ((bar = pattern.find('|', start)) != string::npos)
+    {
+        string fields = pattern.substr(start, bar - start) + ":";
+        start = bar + 1;
+
+        // default voice: unit sine along the y axis, active during the whole loop
+        WaveVoice voice;
+        voice.shape = WAVE_SINE;
+        voice.frequency = 1.0;
+        voice.amplitude = 1.0;
+        voice.phase = 0.0;
+        voice.direction.set(0.0, 1.0, 0.0);
+        voice.amDepth = 0.0;
+        voice.amRate = 0.0;
+        voice.fmDeviation = 0.0;
+        voice.fmRate = 0.0;
+        voice.attack = 0.0;
+        voice.decay = 0.0;
+        voice.sustain = 1.0;
+        voice.release = 0.0;
+        voice.start = 0.0;
+        voice.duration = 0.0;
+
+        size_t first = 0;
+        size_t colon;
+        bool carrier = true;
+        while ((colon = fields.find(':', first)) != string::npos)
+        {
+            string field = fields.substr(first, colon - first);
+            first = colon + 1;
+            const char* value = field.c_str();
+            double x, y, z, w;
+            bool valid = true;
+
+            if (carrier)
+            {
+                // the first field is the carrier shape
+                if (field == "sin")         { voice.shape = WAVE_SINE; }
+                else if (field == "sqr")    { voice.shape = WAVE_SQUARE; }
+                else if (field == "saw")    { voice.shape = WAVE_SAW; }
+                else if (field == "tri")    { voice.shape = WAVE_TRIANGLE; }
+                else                        { valid = false; }
+                carrier = false;
+            }
+            else if (field.compare(0, 2, "am") == 0)
+            {
+                valid = (sscanf(value + 2, "%lf@%lf", &x, &y) == 2);
+                if (valid)
+                {
+                    voice.amDepth = cClamp(x, 0.0, 1.0);
+                    voice.amRate = y;
+                }
+            }
+            else if (field.compare(0, 2, "fm") == 0)
+            {
+                valid = (sscanf(value + 2, "%lf@%lf", &x, &y) == 2) && (y > 0.0);
+                if (valid)
+                {
+                    voice.fmDeviation = x;
+                    voice.fmRate = y;
+                }
+            }
+            else if (field[0] == 'f')   { valid = (sscanf(value + 1, "%lf", &voice.frequency) == 1) && (voice.frequency > 0.0); }
+            else if (field[0] == 'a')   { valid = (sscanf(value + 1, "%lf", &voice.amplitude) == 1); }
+            else if (field[0] == 'p')   { valid = (sscanf(value + 1, "%lf", &voice.phase) == 1); }
+            else if (field[0] == 'd')
+            {
+                valid = (sscanf(value + 1, "%lf,%lf,%lf", &x, &y, &z) == 3);
+                if (valid) { voice.direction.set(x, y, z); }
+            }
+            else if (field[0] == 'e')
+            {
+                valid = (sscanf(value + 1, "%lf,%lf,%lf,%lf", &x, &y, &z, &w) == 4) &&
+                        (x >= 0.0) && (y >= 0.0) && (w >= 0.0);
+                if (valid)
+                {
+                    voice.attack = x;
+                    voice.decay = y;
+                    voice.sustain = cClamp(z, 0.0, 1.0);
+                    voice.release = w;
+                }
+            }
+            else if (field[0] == 't')
+            {
+                valid = (sscanf(value + 1, "%lf,%lf", &x, &y) == 2) && (x >= 0.0) && (y >= 0.0);
+                if (valid)
+                {
+                    voice.start = x;
+                    voice.duration = y;
+                }
+            }
+            else
+            {
+                valid = false;
+            }
+
+            if (!valid) { return (false); }
+        }
+
+        a_voices.push_back(voice);
+    }
+
+    return (!a_voices.empty());
+}
+
+//------------------------------------------------------------------------------
+
+bool compileWaveform(const SceneObjectDesc& a_desc, double a_timeStep, vector<float>& a_table)
+{
+    vector<WaveVoice> voices;
+    if (a_desc.pattern[0] != 0)
+    {
+        if (!parseWaveform(a_desc.pattern, voices)) { return (false); }
+    }
+    else
+    {
+        // without a pattern, oscillators produce the Lissajous figure (-cos, sin, cos)
+        if (a_desc.frequency <= 0.0f) { return (false); }
+        WaveVoice voice;
+        voice.shape = WAVE_SINE;
+        voice.frequency = a_desc.frequency;
+        voice.amplitude = 1.0;
+        voice.phase = 0.0;
+        voice.direction.set(0.0, 1.0, 0.0);
+        voice.amDepth = voice.amRate = 0.0;
+        voice.fmDeviation = voice.fmRate = 0.0;
+        voice.attack = voice.decay = voice.release = 0.0;
+        voice.sustain = 1.0;
+        voice.start = voice.duration = 0.0;
+        voices.push_back(voice);
+        voice.phase = 90.0;
+        voice.direction.set(-1.0, 0.0, 1.0);
+        voices.push_back(voice);
+    }
+
+    // by default, loop over whole periods of the slowest carrier
+    double loop = a_desc.patternLoop;
+    if (loop <= 0.0)
+    {
+        double slowest = voices[0].frequency;
+        for (unsigned int i = 1; i < voices.size(); i++)
+        {
+            slowest = cMin(slowest, voices[i].frequency);
+        }
+        loop = cMax(1.0, ceil(slowest) / slowest);
+    }
+    loop = cMin(loop, MAX_WAVEFORM_LOOP);
+
+    int length = cMax(1, (int)(loop / a_timeStep + 0.5));
+    a_table.assign(3 * length, 0.0f);
+
+    for (unsigned int i = 0; i < voices.size(); i++)
+    {
+        const WaveVoice& voice = voices[i];
+        double duration = (voice.duration > 0.0) ? voice.duration : loop - voice.start;
+        bool envelope = (voice.attack > 0.0) || (voice.decay > 0.0) || (voice.release > 0.0) || (voice.sustain < 1.0);
+
+        for (int k = 0; k < length; k++)
+        {
+            double local = k * a_timeStep - voice.start;
+            if ((local < 0.0) || (local >= duration)) { continue; }
+
+            // carrier phase in cycles; frequency modulation is integrated analytically
+            double cycles = voice.phase / 360.0 + voice.frequency * local;
+            if (voice.fmRate > 0.0)
+            {
+                double w = 2.0 * C_PI * voice.fmRate;
+                cycles += voice.fmDeviation * (1.0 - cos(w * local)) / w;
+            }
+            double angle = 2.0 * C_PI * cycles;
+
+            double value;
+            switch (voice.shape)
+            {
+                case WAVE_SQUARE:   value = (sin(angle) >= 0.0) ? 1.0 : -1.0; break;
+                case WAVE_SAW:      value = 2.0 * (cycles - floor(cycles + 0.5)); break;
+                case WAVE_TRIANGLE: value = (2.0 / C_PI) * asin(sin(angle)); break;
+                default:            value = sin(angle); break;
+            }
+
+            // amplitude modulation
+            if (voice.amDepth > 0.0)
+            {
+                value *= 1.0 - voice.amDepth * (0.5 - 0.5 * sin(2.0 * C_PI * voice.amRate * local));
+            }
+
+            // envelope; the release ends with the voice
+            if (envelope)
+            {
+                double level;
+                if (local < voice.attack)                        { level = local / voice.attack; }
+                else if (local < voice.attack + voice.decay)     { level = 1.0 - (1.0 - voice.sustain) * (local - voice.attack) / voice.decay; }
+                else                                             { level = voice.sustain; }
+                double remaining = duration - local;
+                if (remaining < voice.release)
+                {
+                    level *= remaining / voice.release;
+                }
+                value *= level;
+            }
+
+            value *= voice.amplitude;
+            float* sample = &a_table[3 * k];
+            sample[0] += (float)(value * voice.direction(0));
+            sample[1] += (float)(value * voice.direction(1));
+            sample[2] += (float)(value * voice.direction(2));
+        }
+    }
+
+    return (true);
+}
+
+//------------------------------------------------------------------------------
+
+void computeHapticParams(const SceneObjectDesc& a_desc, HapticParams& a_params)
+{
+    a_params.margin = a_desc.margin;
+    a_params.gain = a_desc.gain;
+    a_params.damping = a_desc.damping;
+    a_params.frequency = a_desc.frequency;
+    a_params.amplitude = a_desc.amplitude;
+    a_params.mass = a_desc.mass;
+    a_params.range = a_desc.range;
+    a_params.bumpDepth = a_desc.bumpDepth;
+    a_params.friction = a_desc.friction;
+
+    // the table is replaced rather than modified, since the haptic thread may still use the previous one
+    a_params.waveform.reset();
+    if (a_desc.behavior == BEHAVIOR_OSCILLATOR)
+    {
+        shared_ptr<vector<float> > table = make_shared<vector<float> >();
+        if (compileWaveform(a_desc, HAPTIC_TIME_STEP, *table))
+        {
+            a_params.waveform = table;
+        }
+    }
+
+    bool absolute = (a_desc.flags & FLAG_ABSOLUTE_STIFFNESS) != 0;
+    a_params.specified = a_desc.specified;
+    a_params.stiffness = absolute ? a_desc.stiffness : a_desc.stiffness * deviceMaxStiffness;
+    a_params.viscosity = a_desc.viscosity * deviceMaxDamping;
+    a_params.magnetMaxForce = a_desc.magnetMaxForce * deviceMaxLinearForce;
+    a_params.magnetMaxDistance = a_desc.magnetMaxDistance;
+    a_params.stickSlipForceMax = a_desc.stickSlipForceMax * deviceMaxLinearForce;
+    a_params.stickSlipStiffness = a_desc.stickSlipStiffness * deviceMaxStiffness;
+    a_params.vibrationFrequency = a_desc.vibrationFrequency;
+    a_params.vibrationAmplitude = a_desc.vibrationAmplitude * deviceMaxLinearForce;
+}
+
+//------------------------------------------------------------------------------
+
+bool reloadHapticParams(void)
+{
+    vector<SceneObjectDesc> descs;
+    if (!loadScene(sceneFile, descs)) { return (false); }
+
+    // match objects by name; objects cannot be added or removed while running,
+    // and objects missing from the file keep their parameters
+    for (unsigned int j = 0; j < descs.size(); j++)
+    {
+        bool found = false;
+        for (unsigned int i = 0; i < reloadedDescs.size(); i++)
+        {
+            if (strncmp(reloadedDescs[i].name, descs[j].name, sizeof(descs[j].name)) == 0)
+            {
+                reloadedDescs[i] = descs[j];
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+        {
+            cout << "Error: object " << descs[j].name << " cannot be added while running" << endl;
+        }
+    }
+
+    // fill the back buffer
+    vector<HapticParams>& params = paramBuffers[paramBack];
+    for (unsigned int i = 0; i < reloadedDescs.size(); i++)
+    {
+        computeHapticParams(reloadedDescs[i], params[i]);
+
+        // the haptic thread keeps a pointer into the table of the buffer it applied
+        // last, so every buffer must hold the table of each oscillator; when the
+        // pattern cannot be compiled (or the object is no longer an oscillator in
+        // the file), the table built with the scene is used again
+        if (!params[i].waveform && sceneObjects[i].waveformTable)
+        {
+            if (reloadedDescs[i].behavior == BEHAVIOR_OSCILLATOR)
+            {
+                cout << "Error: cannot compile the pattern of object " << reloadedDescs[i].name << endl;
+            }
+            params[i].waveform = sceneObjects[i].waveformTable;
+        }
+    }
+
+    // publish the back buffer and take the previously shared buffer in exchange
+    paramBack = paramShared.exchange(paramBack | PARAMS_NEW, memory_order_acq_rel) & 3;
+
+    return (true);
+}
+
+//------------------------------------------------------------------------------
+
+void applyHapticParams(void)
+{
+    // nothing new since the last tick
+    if (!(paramShared.load(memory_order_relaxed) & PARAMS_NEW)) { return; }
+
+    // take the shared buffer; all parameters of a reload are applied within one tick
+    paramFront = paramShared.exchange(paramFront, memory_order_acq_rel) & 3;
+    const vector<HapticParams>& params = paramBuffers[paramFront];
+
+    for (unsigned int i = 0; i < sceneObjects.size(); i++)
+    {
+        const HapticParams& p = params[i];
+        SceneObjectDesc& desc = sceneObjects[i].desc;
+        desc.margin = p.margin;
+        desc.gain = p.gain;
+        desc.damping = p.damping;
+        desc.frequency = p.frequency;
+        desc.amplitude = p.amplitude;
+        desc.mass = p.mass;
+        desc.range = p.range;
+        desc.bumpDepth = p.bumpDepth;
+        desc.friction = p.friction;
+
+        // the table stays alive in the front buffer until the next reload is applied;
+        // the watcher gives every oscillator a table, so none is left behind
+        if (p.waveform && (sceneObjects[i].waveform != NULL))
+        {
+            sceneObjects[i].waveform = &(*p.waveform)[0];
+            sceneObjects[i].waveformLength = (int)p.waveform->size() / 3;
+        }
+
+        // like buildScene, only properties given by the scene are set, so that an
+        // effect can be turned off with a zero, and the others keep their current values
+        cMaterial* material = sceneObjects[i].shape->m_material.get();
+        if (p.specified & PARAM_STIFFNESS)              { material->setStiffness(p.stiffness); }
+        if (p.specified & PARAM_VISCOSITY)              { material->setViscosity(p.viscosity); }
+        if (p.specified & PARAM_MAGNET_MAX_FORCE)       { material->setMagnetMaxForce(p.magnetMaxForce); }
+        if (p.specified & PARAM_MAGNET_MAX_DISTANCE)    { material->setMagnetMaxDistance(p.magnetMaxDistance); }
+        if (p.specified & PARAM_STICK_SLIP_FORCE_MAX)   { material->setStickSlipForceMax(p.stickSlipForceMax); }
+        if (p.specified & PARAM_STICK_SLIP_STIFFNESS)   { material->setStickSlipStiffness(p.stickSlipStiffness); }
+        if (p.specified & PARAM_VIBRATION_FREQUENCY)    { material->setVibrationFrequency(p.vibrationFrequency); }
+        if (p.specified & PARAM_VIBRATION_AMPLITUDE)    { material->setVibrationAmplitude(p.vibrationAmplitude); }
+    }
+
+    if (shareState)
+    {
+        sceneStateWriter.publishEvent(simClock.getCurrentTimeSeconds(), SCENE_EVENT_PARAMS_RELOADED, -1);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void watchHapticParams(void)
+{
+#ifdef __linux__
+    // watch the directory, since editors often save by replacing the file
+    size_t slash = sceneFile.find_last_of('/');
+    string directory = (slash == string::npos) ? "." : sceneFile.substr(0, slash);
+    string name = (slash == string::npos) ? sceneFile : sceneFile.substr(slash + 1);
+
+    int fd = inotify_init1(IN_NONBLOCK);
+    if ((fd < 0) || (inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0))
+    {
+        cout << "Error: cannot watch " << sceneFile << endl;
+        if (fd >= 0) { ::close(fd); }
+        watcherFinished = true;
+        return;
+    }
+
+    while (watcherRunning)
+    {
+        // wait for events, waking up regularly to check for termination
+        struct pollfd request = { fd, POLLIN, 0 };
+        if (poll(&request, 1, 100) <= 0) { continue; }
+
+        char buffer[4096];
+        bool changed = false;
+        ssize_t length;
+        while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char* ptr = buffer; ptr < buffer + length; )
+            {
+                const struct inotify_event* event = (const struct inotify_event*)ptr;
+                if ((event->len > 0) && (name == event->name)) { changed = true; }
+                ptr += sizeof(struct inotify_event) + event->len;
+            }
+        }
+
+        if (changed && reloadHapticParams())
+        {
+            cout << "reloaded haptic parameters from " << sceneFile << endl;
+        }
+    }
+
+    ::close(fd);
+#else
+    // without inotify, poll the modification time of the file
+    struct stat info;
+    time_t modified = (stat(sceneFile.c_str(), &info) == 0) ? info.st_mtime : 0;
+    while (watcherRunning)
+    {
+        cSleepMs(250);
+        if ((stat(sceneFile.c_str(), &info) == 0) && (info.st_mtime != modified))
+        {
+            modified = info.st_mtime;
+            if (reloadHapticParams())
+            {
+                cout << "reloaded haptic parameters from " << sceneFile << endl;
+            }
+        }
+    }
+#endif
+
+    watcherFinished = true;
+}
+
+//------------------------------------------------------------------------------
+
+cTexture2dPtr getSharedTexture(const string& a_filename, bool a_sphericalMapping)
+{
+    // the mapping mode is a property of the texture, so it is part of the key
+    string key = a_filename + (a_sphericalMapping ? "#spherical" : "");
+    map<string, cTexture2dPtr>::iterator it = textureCache.find(key);
+    if (it != textureCache.end())
+    {
+        return (it->second);
+    }
+
+    // create an empty texture; its image is installed once decoded
+    cTexture2dPtr texture = cTexture2d::create();
+    texture->setSphericalMappingEnabled(a_sphericalMapping);
+    textureCache[key] = texture;
+
+    TextureJob job;
+    job.path = a_filename;
+    job.texture = texture;
+    textureMutex.acquire();
+    textureJobs.push_back(job);
+    textureMutex.release();
+
+    return (texture);
+}
+
+//------------------------------------------------------------------------------
+
+void startTextureLoading(void)
+{
+    textureMutex.acquire();
+    int numJobs = (int)textureJobs.size();
+    textureMutex.release();
+
+    int numWorkers = cMin(NUM_TEXTURE_WORKERS, numJobs);
+    textureWorkersActive = numWorkers;
+    for (int i = 0; i < numWorkers; i++)
+    {
+        cThread* worker = new cThread();
+        worker->start(loadTextures, CTHREAD_PRIORITY_GRAPHICS);
+        textureWorkers.push_back(worker);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void loadTextures(void)
+{
+    while (true)
+    {
+        // get next image to decode; all images are queued before the workers start,
+        // so the worker terminates once the queue is empty
+        textureMutex.acquire();
+        if (textureJobs.empty())
+        {
+            textureMutex.release();
+            break;
+        }
+        TextureJob job = textureJobs.front();
+        textureJobs.pop_front();
+        textureMutex.release();
+
+        // decode image
+        job.image = cImage::create();
+        if (!loadResourceImage(job.path, job.image))
+        {
+            cout << "Error: cannot load texture " << job.path << endl;
+            continue;
+        }
+
+        // hand the image over to the render thread
+        textureMutex.acquire();
+        decodedTextures.push_back(job);
+        textureMutex.release();
+    }
+
+    textureWorkersActive--;
+}
+
+//------------------------------------------------------------------------------
+
+void installDecodedTextures(void)
+{
+    // install images decoded since the last frame; the texture is uploaded to the GPU
+    // the next time it is rendered, by this thread, which owns the display context
+    textureMutex.acquire();
+    while (!decodedTextures.empty())
+    {
+        TextureJob& job = decodedTextures.front();
+        job.texture->setImage(job.image);
+        decodedTextures.pop_front();
+    }
+    textureMutex.release();
+}
+
+//------------------------------------------------------------------------------
+
+bool loadResourceImage(const string& a_filename, cImagePtr a_image)
+{
+    // images are searched next to the executable first, then in the working directory
+    string searchPaths[3] = { cGetCurrentPath() + "../resources/images/", "resources/images/", "" };
+    for (int i = 0; i < 3; i++)
+    {
+        if (a_image->loadFromFile(searchPaths[i] + a_filename))
+        {
+            return (true);
+        }
+    }
+    return (false);
+}
+
+//------------------------------------------------------------------------------
+
+bool loadHapticMap(const string& a_name, int& a_width, int& a_height, vector<float>& a_values)
+{
+    // procedural maps, in longitude u and latitude v
+    if ((a_name == "bumps") || (a_name == "grooves") || (a_name == "rough"))
+    {
+        a_width = PROCEDURAL_TEXTURE_WIDTH;
+        a_height = PROCEDURAL_TEXTURE_HEIGHT;
+        a_values.resize(a_width * a_height);
+
+        // lattice of random values for the rough map
+        const int LATTICE = 64;
+        vector<float> lattice(LATTICE * LATTICE);
+        uint32_t seed = 12345;
+        for (unsigned int i = 0; i < lattice.size(); i++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            lattice[i] = (float)(seed >> 8) / (float)(1 << 24);
+        }
+
+        for (int y = 0; y < a_height; y++)
+        {
+            for (int x = 0; x < a_width; x++)
+            {
+                double u = (x + 0.5) / a_width;
+                double v = (y + 0.5) / a_height;
+                double value;
+                if (a_name == "bumps")
+                {
+                    value = 0.5 + 0.5 * sin(2.0 * C_PI * 24.0 * u) * sin(2.0 * C_PI * 12.0 * v);
+                }
+                else if (a_name == "grooves")
+                {
+                    // narrow grooves across the longitude
+                    value = cMin(1.0, 4.0 * fabs(sin(C_PI * 48.0 * u)));
+                }
+                else
+                {
+                    // value noise, smoothly interpolated and wrapped in longitude
+                    double lx = u * LATTICE;
+                    double ly = v * (LATTICE - 1);
+                    int x0 = (int)lx;
+                    int y0 = cMin((int)ly, LATTICE - 2);
+                    double fx = lx - x0;
+                    double fy = ly - y0;
+                    fx = fx * fx * (3.0 - 2.0 * fx);
+                    fy = fy * fy * (3.0 - 2.0 * fy);
+                    int x1 = (x0 + 1) % LATTICE;
+                    double top = lattice[y0 * LATTICE + x0] * (1.0 - fx) + lattice[y0 * LATTICE + x1] * fx;
+                    double bottom = lattice[(y0 + 1) * LATTICE + x0] * (1.0 - fx) + lattice[(y0 + 1) * LATTICE + x1] * fx;
+                    value = top * (1.0 - fy) + bottom * fy;
+                }
+                a_values[y * a_width + x] = (float)value;
+            }
+        }
+        return (true);
+    }
+
+    // images are converted to luminance
+    cImagePtr image = cImage::create();
+    if (!loadResourceImage(a_name, image))
+    {
+        cout << "Error: cannot load haptic map " << a_name << endl;
+        return (false);
+    }
+    a_width = image->getWidth();
+    a_height = image->getHeight();
+    if ((a_width < 2) || (a_height < 2)) { return (false); }
+    a_values.resize(a_width * a_height);
+    for (int y = 0; y < a_height; y++)
+    {
+        for (int x = 0; x < a_width; x++)
+        {
+            cColorf color;
+            image->getPixelColor(x, y, color);
+            a_values[y * a_width + x] = 0.299f * color.getR() + 0.587f * color.getG() + 0.114f * color.getB();
+        }
+    }
+    return (true);
+}
+
+//------------------------------------------------------------------------------
+
+shared_ptr<HapticTexture> getHapticTexture(const string& a_heightMap, const string& a_frictionMap)
+{
+    string key = a_heightMap + "#" + a_frictionMap;
+    map<string, shared_ptr<HapticTexture> >::iterator it = hapticTextureCache.find(key);
+    if (it != hapticTextureCache.end())
+    {
+        return (it->second);
+    }
+
+    int width, height;
+    vector<float> heights;
+    if (!loadHapticMap(a_heightMap, width, height, heights))
+    {
+        return (shared_ptr<HapticTexture>());
+    }
+
+    // the friction map is resampled to the resolution of the height map
+    int frictionWidth = 1, frictionHeight = 1;
+    vector<float> frictions(1, 1.0f);
+    if (!a_frictionMap.empty() && !loadHapticMap(a_frictionMap, frictionWidth, frictionHeight, frictions))
+    {
+        return (shared_ptr<HapticTexture>());
+    }
+
+    shared_ptr<HapticTexture> texture = make_shared<HapticTexture>();
+    vector<float> friction(width * height);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            friction[y * width + x] = frictions[(y * frictionHeight / height) * frictionWidth + x * frictionWidth / width];
+        }
+    }
+
+    // build the mipmaps by averaging 2x2 blocks, down to 8 texels along the latitude
+    while (true)
+    {
+        // slopes by central differences, wrapped in longitude and clamped in latitude
+        vector<HapticTexel> texels(width * height);
+        for (int y = 0; y < height; y++)
+        {
+            int up = cMax(y - 1, 0);
+            int down = cMin(y + 1, height - 1);
+            for (int x = 0; x < width; x++)
+            {
+                int left = (x + width - 1) % width;
+                int right = (x + 1) % width;
+                HapticTexel& texel = texels[y * width + x];
+                texel.height = heights[y * width + x];
+                texel.slopeU = 0.5f * (heights[y * width + right] - heights[y * width + left]) * width;
+                texel.slopeV = (heights[down * width + x] - heights[up * width + x]) * height / (float)(down - up);
+                texel.friction = friction[y * width + x];
+            }
+        }
+        texture->levels.push_back(texels);
+        texture->widths.push_back(width);
+        texture->heights.push_back(height);
+
+        if ((width < 2) || (height < 16)) { break; }
+
+        int halfWidth = width / 2;
+        int halfHeight = height / 2;
+        vector<float> halfHeights(halfWidth * halfHeight);
+        vector<float> halfFriction(halfWidth * halfHeight);
+        for (int y = 0; y < halfHeight; y++)
+        {
+            for (int x = 0; x < halfWidth; x++)
+            {
+                int i = (2 * y) * width + 2 * x;
+                halfHeights[y * halfWidth + x] = 0.25f * (heights[i] + heights[i + 1] + heights[i + width] + heights[i + width + 1]);
+                halfFriction[y * halfWidth + x] = 0.25f * (friction[i] + friction[i + 1] + friction[i + width] + friction[i + width + 1]);
+            }
+        }
+        width = halfWidth;
+        height = halfHeight;
+        heights.swap(halfHeights);
+        friction.swap(halfFriction);
+    }
+
+    hapticTextureCache[key] = texture;
+    return (texture);
+}
+
+//------------------------------------------------------------------------------
+
+cVector3d computeTextureForce(const SceneObject& a_object, const cVector3d& a_toolPos,
+                              const cVector3d& a_toolVel, const cVector3d& a_contactForce)
+{
+    const SceneObjectDesc& desc = a_object.desc;
+    cVector3d offset = a_toolPos - transforms.getPos(a_object.id);
+    double dist = offset.length();
+    if (dist < C_SMALL) { return (cVector3d(0, 0, 0)); }
+    cVector3d normal = offset / dist;
+
+    // spherical coordinates of the contact; u follows the longitude and v the latitude
+    double longitude = atan2(normal(1), normal(0));
+    double colatitude = acos(cClamp(normal(2), -1.0, 1.0));
+    int x = (int)((longitude / (2.0 * C_PI) + 0.5) * a_object.texelWidth);
+    int y = (int)(colatitude / C_PI * a_object.texelHeight);
+    x = cClamp(x, 0, a_object.texelWidth - 1);
+    y = cClamp(y, 0, a_object.texelHeight - 1);
+    const HapticTexel& texel = a_object.texels[y * a_object.texelWidth + x];
+
+    // surface gradient of the height field, along the east and south tangents
+    double sinColatitude = cMax(sin(colatitude), 0.05);
+    double cosLongitude = cos(longitude);
+    double sinLongitude = sin(longitude);
+    cVector3d east(-sinLongitude, cosLongitude, 0.0);
+    cVector3d south(cos(colatitude) * cosLongitude, cos(colatitude) * sinLongitude, -sin(colatitude));
+    cVector3d gradient = (desc.bumpDepth * texel.slopeU / (2.0 * C_PI * desc.radius * sinColatitude)) * east +
+                         (desc.bumpDepth * texel.slopeV / (C_PI * desc.radius)) * south;
+
+    // the contact force follows the normal of the displaced surface, and raised
+    // areas push back as if the surface were offset by their height; the offset
+    // is engaged over the first bump depth of penetration, so that it neither
+    // steps at first contact nor pulls the tool into hollows at the surface
+    double normalForce = cMax(a_contactForce.dot(normal), 0.0);
+    cVector3d force = -normalForce * gradient;
+    double bumpForce = a_object.shape->m_material->getStiffness() * desc.bumpDepth;
+    if (bumpForce > 0.0)
+    {
+        double engagement = cMin(normalForce / bumpForce, 1.0);
+        force += (engagement * bumpForce * (texel.height - 0.5)) * normal;
+    }
+
+    // kinetic friction opposing the tangential velocity, smoothed near rest
+    if (desc.friction > 0.0f)
+    {
+        cVector3d tangentVel = a_toolVel - a_toolVel.dot(normal) * normal;
+        force -= (desc.friction * texel.friction * normalForce / (tangentVel.length() + 0.01)) * tangentVel;
+    }
+
+    return (force);
+}
+
+//------------------------------------------------------------------------------
+
+// vertex shader of the sphere batch; in single-pass stereo each sphere is drawn
+// as two instances, one per eye, and each eye is clipped to its half of the viewport
+const char* sphereBatchVertexShader =
+    "#version 330 core\n"
+    "layout(location = 0) in vec3 aPosition;\n"
+    "layout(location = 1) in vec4 aSphere;\n"
+    "layout(location = 2) in vec4 aAmbient;\n"
+    "layout(location = 3) in vec4 aDiffuse;\n"
+    "layout(location = 4) in vec4 aSpecular;\n"
+    "layout(location = 5) in float aTextured;\n"
+    "layout(std140) uniform Frame\n"
+    "{\n"
+    "    mat4 uViewProjection[2];\n"
+    "    mat4 uView[2];\n"
+    "    vec4 uEyePosition[2];\n"
+    "    vec4 uLightPosition;\n"
+    "    vec4 uLightDirection;\n"
+    "    vec4 uLightAmbient;\n"
+    "    vec4 uLightDiffuse;\n"
+    "    vec4 uLightSpecular;\n"
+    "    ivec4 uStereo;\n"
+    "};\n"
+    "out vec3 vPosition;\n"
+    "out vec3 vNormal;\n"
+    "flat out int vEye;\n"
+    "flat out vec4 vAmbient;\n"
+    "flat out vec4 vDiffuse;\n"
+    "flat out vec4 vSpecular;\n"
+    "flat out float vTextured;\n"
+    "out float gl_ClipDistance[1];\n"
+    "void main()\n"
+    "{\n"
+    "    int eye = (uStereo.x != 0) ? (gl_InstanceID & 1) : 0;\n"
+    "    vec3 position = aSphere.xyz + aSphere.w * aPosition;\n"
+    "    vPosition = position;\n"
+    "    vNormal = aPosition;\n"
+    "    vEye = eye;\n"
+    "    vAmbient = aAmbient;\n"
+    "    vDiffuse = aDiffuse;\n"
+    "    vSpecular = aSpecular;\n"
+    "    vTextured = aTextured;\n"
+    "    vec4 clip = uViewProjection[eye] * vec4(position, 1.0);\n"
+    "    float side = (eye == 0) ? -1.0 : 1.0;\n"
+    "    gl_ClipDistance[0] = 1.0;\n"
+    "    if (uStereo.x == 1)\n"
+    "    {\n"
+    "        clip.x = 0.5 * clip.x + 0.5 * side * clip.w;\n"
+    "        gl_ClipDistance[0] = side * clip.x;\n"
+    "    }\n"
+    "    else if (uStereo.x == 2)\n"
+    "    {\n"
+    "        clip.y = 0.5 * clip.y - 0.5 * side * clip.w;\n"
+    "        gl_ClipDistance[0] = -side * clip.y;\n"
+    "    }\n"
+    "    gl_Position = clip;\n"
+    "}\n";
+
+// fragment shader of the sphere batch; lighting is computed in world coordinates
+// and spherical texture mapping in the coordinates of the eye
+const char* sphereBatchFragmentShader =
+    "#version 330 core\n"
+    "layout(std140) uniform Frame\n"
+    "{\n"
+    "    mat4 uViewProjection[2];\n"
+    "    mat4 uView[2];\n"
+    "    vec4 uEyePosition[2];\n"
+    "    vec4 uLightPosition;\n"
+    "    vec4 uLightDirection;\n"
+    "    vec4 uLightAmbient;\n"
+    "    vec4 uLightDiffuse;\n"
+    "    vec4 uLightSpecular;\n"
+    "    ivec4 uStereo;\n"
+    "};\n"
+
+    "uniform sampler2D uSphereMap;\n"
+    "in vec3 vPosition;\n"
+    "in vec3 vNormal;\n"
+    "flat in int vEye;\n"
+    "flat in vec4 vAmbient;\n"
+    "flat in vec4 vDiffuse;\n"
+    "flat in vec4 vSpecular;\n"
+    "flat in float vTextured;\n"
+    "out vec4 fragColor;\n"
+    "void main()\n"
+    "{\n"
+    "    vec3 n = normalize(vNormal);\n"
+    "    vec3 v = normalize(uEyePosition[vEye].xyz - vPosition);\n"
+    "    vec3 l = normalize(uLightPosition.xyz - vPosition);\n"
+    "    float spot = (dot(-l, uLightDirection.xyz) >= uLightDirection.w) ? 1.0 : 0.0;\n"
+    "    float diffuse = spot * max(dot(n, l), 0.0);\n"
+    "    float specular = (diffuse > 0.0) ? spot * pow(max(dot(n, normalize(l + v)), 0.0), vSpecular.w) : 0.0;\n"
+    "    vec3 color = vAmbient.rgb * uLightAmbient.rgb +\n"
+    "                 vDiffuse.rgb * uLightDiffuse.rgb * diffuse +\n"
+    "                 vSpecular.rgb * uLightSpecular.rgb * specular;\n"
+    "    if (vTextured > 0.5)\n"
+    "    {\n"
+    "        vec3 r = mat3(uView[vEye]) * reflect(-v, n);\n"
+    "        float m = 2.0 * sqrt(r.x * r.x + r.y * r.y + (r.z + 1.0) * (r.z + 1.0));\n"
+    "        color *= texture(uSphereMap, r.xy / m + 0.5).rgb;\n"
+    "    }\n"
+    "    fragColor = vec4(color, vDiffuse.a);\n"
+    "}\n";
+
+//------------------------------------------------------------------------------
+
+// multiply two column-major 4x4 matrices
+void multiplyMatrices(const float* a_left, const float* a_right, float* a_result)
+{
+    for (int c = 0; c < 4; c++)
+    {
+        for (int r = 0; r < 4; r++)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; k++)
+            {
+                sum += a_left[4 * k + r] * a_right[4 * c + k];
+            }
+            a_result[4 * c + r] = sum;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+cSphereBatch::cSphereBatch()
+{
+    m_program = 0;
+    m_vertexArray = 0;
+    m_vertexBuffer = 0;
+    m_indexBuffer = 0;
+    m_instanceBuffer = 0;
+    m_frameBuffer = 0;
+    m_indexCount = 0;
+    m_stereoMode = C_STEREO_DISABLED;
+    m_initialized = false;
+    m_failed = false;
+}
+
+//------------------------------------------------------------------------------
+
+cSphereBatch::~cSphereBatch()
+{
+    // OpenGL objects are owned by the display context, which is destroyed with
+    // the window; they are not released here since no context may be current
+}
+
+//------------------------------------------------------------------------------
+
+void cSphereBatch::addSphere(cShapeSphere* a_sphere)
+{
+    m_spheres.push_back(a_sphere);
+
+    // the fixed-function path no longer draws the sphere
+    a_sphere->setShowEnabled(false);
+}
+
+//------------------------------------------------------------------------------
+
+bool cSphereBatch::initialize()
+{
+    // compile shaders
+    const char* sources[2] = { sphereBatchVertexShader, sphereBatchFragmentShader };
+    GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    m_program = glCreateProgram();
+    for (int i = 0; i < 2; i++)
+    {
+        GLuint shader = glCreateShader(types[i]);
+        glShaderSource(shader, 1, &sources[i], NULL);
+        glCompileShader(shader);
+        GLint status = 0;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+        if (!status)
+        {
+            char log[1024];
+            glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+            cout << "Error: sphere batch shader: " << log << endl;
+            glDeleteShader(shader);
+            return (false);
+        }
+        glAttachShader(m_program, shader);
+        glDeleteShader(shader);
+    }
+    glLinkProgram(m_program);
+    GLint status = 0;
+    glGetProgramiv(m_program, GL_LINK_STATUS, &status);
+    if (!status)
+    {
+        char log[1024];
+        glGetProgramInfoLog(m_program, sizeof(log), NULL, log);
+        cout << "Error: sphere batch program: " << log << endl;
+        return (false);
+    }
+
+    // bind uniform block and sampler
+    glUniformBlockBinding(m_program, glGetUniformBlockIndex(m_program, "Frame"), 0);
+    glUseProgram(m_program);
+    glUniform1i(glGetUniformLocation(m_program, "uSphereMap"), 0);
+    glUseProgram(0);
+
+    // build unit sphere mesh; positions are also the normals
+    const int slices = 32;
+    const int stacks = 24;
+    vector<float> vertices;
+    vector<GLuint> indices;
+    for (int i = 0; i <= stacks; i++)
+    {
+        double theta = C_PI * (double)i / (double)stacks;
+        for (int j = 0; j <= slices; j++)
+        {
+            double phi = 2.0 * C_PI * (double)j / (double)slices;
+            vertices.push_back((float)(sin(theta) * cos(phi)));
+            vertices.push_back((float)(sin(theta) * sin(phi)));
+            vertices.push_back((float)(cos(theta)));
+        }
+    }
+    for (int i = 0; i < stacks; i++)
+    {
+        for (int j = 0; j < slices; j++)
+        {
+            GLuint a = i * (slices + 1) + j;
+            GLuint b = a + slices + 1;
+            indices.push_back(a); indices.push_back(b); indices.push_back(a + 1);
+            indices.push_back(a + 1); indices.push_back(b); indices.push_back(b + 1);
+        }
+    }
+    m_indexCount = (GLsizei)indices.size();
+
+    // create buffers
+    glGenVertexArrays(1, &m_vertexArray);
+    glBindVertexArray(m_vertexArray);
+
+    glGenBuffers(1, &m_vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glGenBuffers(1, &m_indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+
+    glGenBuffers(1, &m_instanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+    for (GLuint i = 1; i <= 5; i++)
+    {
+        glEnableVertexAttribArray(i);
+        glVertexAttribDivisor(i, 1);
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenBuffers(1, &m_frameBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_frameBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(BatchFrameUniforms), NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    return (true);
+}
+
+//------------------------------------------------------------------------------
+
+GLuint cSphereBatch::getTexture(cTexture2dPtr a_texture)
+{
+    if ((a_texture == nullptr) || (a_texture->m_image == nullptr)) { return (0); }
+
+    // create or update the OpenGL texture when the image changes
+    pair<cImage*, GLuint>& entry = m_textures[a_texture.get()];
+    cImage* image = a_texture->m_image.get();
+    if ((entry.first == image) && (entry.second != 0)) { return (entry.second); }
+
+    if ((image->getWidth() == 0) || (image->getHeight() == 0)) { return (0); }
+
+    if (entry.second == 0)
+    {
+        glGenTextures(1, &entry.second);
+    }
+    entry.first = image;
+
+    glBindTexture(GL_TEXTURE_2D, entry.second);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image->getWidth(), image->getHeight(), 0,
+                 image->getFormat(), GL_UNSIGNED_BYTE, image->getData());
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return (entry.second);
+}
+
+//------------------------------------------------------------------------------
+
+void cSphereBatch::render(cRenderOptions& a_options)
+{
+    // spheres are opaque and do not cast shadows
+    if (a_options.m_creating_shadow_map) { return; }
+    if (!SECTION_RENDER_PARTS_WITH_MATERIALS(a_options, false)) { return; }
+    if (m_failed || m_spheres.empty()) { return; }
+
+    if (!m_initialized)
+    {
+        m_initialized = true;
+        if (!initialize())
+        {
+            // fall back to the fixed-function path
+            m_failed = true;
+            for (unsigned int i = 0; i < m_spheres.size(); i++)
+            {
+                m_spheres[i]->setShowEnabled(true);
+            }
+            return;
+        }
+    }
+
+    /////////////////////////////////////////////////////////////////////
+    // FRAME UNIFORMS
+    /////////////////////////////////////////////////////////////////////
+
+    BatchFrameUniforms frame;
+    int numEyes = 1;
+
+    if (m_stereoMode == C_STEREO_DISABLED)
+    {
+        // the camera transformation is the current modelview since the batch is at the origin
+        float projection[16];
+        glGetFloatv(GL_PROJECTION_MATRIX, projection);
+        glGetFloatv(GL_MODELVIEW_MATRIX, frame.view[0]);
+        multiplyMatrices(projection, frame.view[0], frame.viewProjection[0]);
+        cVector3d eyePos = camera->getGlobalPos();
+        for (int i = 0; i < 3; i++) { frame.eyePosition[0][i] = (float)eyePos(i); }
+        frame.eyePosition[0][3] = 1.0f;
+        frame.stereo[0] = 0;
+    }
+    else
+    {
+        // build both eye transformations from the stereo parameters of the camera,
+        // matching the asymmetric frustums used by the two-pass stereo path
+        numEyes = 2;
+        double separation = camera->getStereoEyeSeparation();
+        double focalLength = camera->getStereoFocalLength();
+        double zNear = camera->getNearClippingPlane();
+        double zFar = camera->getFarClippingPlane();
+        double aspect = (double)framebufferW / (double)cMax(framebufferH, 1);
+        if (m_stereoMode == C_STEREO_PASSIVE_LEFT_RIGHT) { aspect *= 0.5; }
+        else { aspect *= 2.0; }
+        double top = zNear * tan(0.5 * cDegToRad(camera->getFieldViewAngleDeg()));
+        double bottom = -top;
+        if (mirroredDisplay) { top = -top; bottom = -bottom; }
+        double halfWidth = fabs(top) * aspect;
+
+        cVector3d look = camera->getLookVector();
+        cVector3d up = camera->getUpVector();
+        cVector3d right = camera->getRightVector();
+
+        for (int eye = 0; eye < 2; eye++)
+        {
+            double side = (eye == 0) ? -1.0 : 1.0;
+            cVector3d eyePos = camera->getGlobalPos() + (0.5 * side * separation) * right;
+            double shift = -0.5 * side * separation * zNear / focalLength;
+            double l = -halfWidth + shift;
+            double r = halfWidth + shift;
+
+            // asymmetric perspective projection
+            float projection[16] = { 0 };
+            projection[0] = (float)(2.0 * zNear / (r - l));
+            projection[5] = (float)(2.0 * zNear / (top - bottom));
+            projection[8] = (float)((r + l) / (r - l));
+            projection[9] = (float)((top + bottom) / (top - bottom));
+            projection[10] = (float)(-(zFar + zNear) / (zFar - zNear));
+            projection[11] = -1.0f;
+            projection[14] = (float)(-2.0 * zFar * zNear / (zFar - zNear));
+
+            // view transformation looking along the camera axis
+            float* view = frame.view[eye];
+            for (int i = 0; i < 3; i++)
+            {
+                view[4 * i + 0] = (float)right(i);
+                view[4 * i + 1] = (float)up(i);
+                view[4 * i + 2] = (float)-look(i);
+                view[4 * i + 3] = 0.0f;
+            }
+            view[12] = (float)-right.dot(eyePos);
+            view[13] = (float)-up.dot(eyePos);
+            view[14] = (float)look.dot(eyePos);
+            view[15] = 1.0f;
+
+            multiplyMatrices(projection, view, frame.viewProjection[eye]);
+            for (int i = 0; i < 3; i++) { frame.eyePosition[eye][i] = (float)eyePos(i); }
+            frame.eyePosition[eye][3] = 1.0f;
+        }
+        frame.stereo[0] = (m_stereoMode == C_STEREO_PASSIVE_LEFT_RIGHT) ? 1 : 2;
+    }
+    frame.stereo[1] = frame.stereo[2] = frame.stereo[3] = 0;
+
+    // light position and direction in world coordinates
+    cVector3d lightPos = light->getGlobalPos();
+    cVector3d lightDir = light->getDir();
+    lightDir.normalize();
+    for (int i = 0; i < 3; i++)
+    {
+        frame.lightPosition[i] = (float)lightPos(i);
+        frame.lightDirection[i] = (float)lightDir(i);
+    }
+    frame.lightPosition[3] = 1.0f;
+    frame.lightDirection[3] = (float)cos(cDegToRad(light->getCutOffAngleDeg()));
+    cColorf* lightColors[3] = { &light->m_ambient, &light->m_diffuse, &light->m_specular };
+    float* lightData[3] = { frame.lightAmbient, frame.lightDiffuse, frame.lightSpecular };
+    for (int i = 0; i < 3; i++)
+    {
+        lightData[i][0] = lightColors[i]->getR();
+        lightData[i][1] = lightColors[i]->getG();
+        lightData[i][2] = lightColors[i]->getB();
+        lightData[i][3] = lightColors[i]->getA();
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, m_frameBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame), &frame);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    /////////////////////////////////////////////////////////////////////
+    // MATERIALS AND INSTANCES
+    /////////////////////////////////////////////////////////////////////
+
+    // sort instances by texture so that each texture is bound once and all spheres
+    // sharing it are drawn by one call; the order is only rebuilt when a sphere is
+    // shown, hidden or changes texture
+    bool changed = (m_sphereTextures.size() != m_spheres.size());
+    m_sphereTextures.resize(m_spheres.size(), 0);
+    m_sphereShown.resize(m_spheres.size(), false);
+    for (unsigned int i = 0; i < m_spheres.size(); i++)
+    {
+        cShapeSphere* sphere = m_spheres[i];
+        bool shown = sphere->getEnabled();
+        GLuint texture = (shown && sphere->getUseTexture()) ? getTexture(sphere->m_texture) : 0;
+        if ((shown != m_sphereShown[i]) || (texture != m_sphereTextures[i]))
+        {
+            m_sphereShown[i] = shown;
+            m_sphereTextures[i] = texture;
+            changed = true;
+        }
+    }
+
+    if (changed)
+    {
+        m_order.clear();
+        for (unsigned int i = 0; i < m_spheres.size(); i++)
+        {
+            if (m_sphereShown[i]) { m_order.push_back(i); }
+        }
+        stable_sort(m_order.begin(), m_order.end(),
+                    [this](int a, int b) { return (m_sphereTextures[a] < m_sphereTextures[b]); });
+
+        m_groups.clear();
+        for (unsigned int k = 0; k < m_order.size(); k++)
+        {
+            GLuint texture = m_sphereTextures[m_order[k]];
+            if (m_groups.empty() || (m_groups.back().first != texture)) { m_groups.push_back(make_pair(texture, 0)); }
+            m_groups.back().second++;
+        }
+        m_instanceData.resize(BATCH_INSTANCE_FLOATS * m_order.size());
+    }
+    if (m_order.empty()) { return; }
+
+    // each instance carries its own material, so the number of materials is not limited
+    for (unsigned int k = 0; k < m_order.size(); k++)
+    {
+        cShapeSphere* sphere = m_spheres[m_order[k]];
+        cMaterial* material = sphere->m_material.get();
+        float* data = &m_instanceData[BATCH_INSTANCE_FLOATS * k];
+        cVector3d pos = sphere->getLocalPos();
+        data[0] = (float)pos(0);
+        data[1] = (float)pos(1);
+        data[2] = (float)pos(2);
+        data[3] = (float)sphere->getRadius();
+        cColorf* colors[3] = { &material->m_ambient, &material->m_diffuse, &material->m_specular };
+        for (int j = 0; j < 3; j++)
+        {
+            data[4 + 4 * j + 0] = colors[j]->getR();
+            data[4 + 4 * j + 1] = colors[j]->getG();
+            data[4 + 4 * j + 2] = colors[j]->getB();
+            data[4 + 4 * j + 3] = colors[j]->getA();
+        }
+        data[15] = (float)material->getShininess();
+        data[16] = (m_sphereTextures[m_order[k]] != 0) ? 1.0f : 0.0f;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, m_instanceData.size() * sizeof(float), &m_instanceData[0], GL_STREAM_DRAW);
+
+    /////////////////////////////////////////////////////////////////////
+    // DRAW
+    /////////////////////////////////////////////////////////////////////
+
+    glUseProgram(m_program);
+    glBindVertexArray(m_vertexArray);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, m_frameBuffer);
+    glActiveTexture(GL_TEXTURE0);
+
+    // in single-pass stereo, each set of instance attributes is used by two instances
+    for (GLuint i = 1; i <= 5; i++) { glVertexAttribDivisor(i, numEyes); }
+    if (numEyes > 1) { glEnable(GL_CLIP_DISTANCE0); }
+
+    const GLsizei stride = BATCH_INSTANCE_FLOATS * sizeof(float);
+    const GLint sizes[5] = { 4, 4, 4, 4, 1 };
+    size_t first = 0;
+    for (unsigned int g = 0; g < m_groups.size(); g++)
+    {
+        // point the instance attributes at the first instance of the group
+        size_t offset = first * stride;
+        for (GLuint i = 0; i < 5; i++)
+        {
+            glVertexAttribPointer(i + 1, sizes[i], GL_FLOAT, GL_FALSE, stride, (const void*)offset);
+            offset += sizes[i] * sizeof(float);
+        }
+        glBindTexture(GL_TEXTURE_2D, m_groups[g].first);
+        glDrawElementsInstanced(GL_TRIANGLES, m_indexCount, GL_UNSIGNED_INT, 0, numEyes * m_groups[g].second);
+        first += m_groups[g].second;
+    }
+
+    // restore state expected by the fixed-function path
+    glDisable(GL_CLIP_DISTANCE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glUseProgram(0);
+}
+
+//------------------------------------------------------------------------------
+
+void cStereoOverlay::render(cRenderOptions& a_options)
+{
+    if (m_stereoMode == C_STEREO_DISABLED)
+    {
+        m_widgets->renderSceneGraph(a_options);
+        return;
+    }
+
+    // split the viewport of the camera between the eyes like the sphere batch does
+    // (left eye on the left or top half), and stretch the layer along the split
+    // axis so that the widgets keep their size in pixels
+    GLint view[4];
+    glGetIntegerv(GL_VIEWPORT, view);
+    bool leftRight = (m_stereoMode == C_STEREO_PASSIVE_LEFT_RIGHT);
+    int eyeW = leftRight ? view[2] / 2 : view[2];
+    int eyeH = leftRight ? view[3] : view[3] / 2;
+
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glScaled(leftRight ? 2.0 : 1.0, leftRight ? 1.0 : 2.0, 1.0);
+    for (int eye = 0; eye < 2; eye++)
+    {
+        int x = view[0] + ((leftRight && (eye == 1)) ? eyeW : 0);
+        int y = view[1] + ((!leftRight && (eye == 0)) ? eyeH : 0);
+        glViewport(x, y, eyeW, eyeH);
+        m_widgets->renderSceneGraph(a_options);
+    }
+    glPopMatrix();
+    glViewport(view[0], view[1], view[2], view[3]);
+}
+
+//------------------------------------------------------------------------------
+
+void setStereoRendering(bool a_singlePass)
+{
+    // single-pass stereo draws the spheres with the batch, so any other object of
+    // the world is rendered in mono; it is only used with the OpenGL 3.3 backend
+    bool passive = (stereoMode == C_STEREO_PASSIVE_LEFT_RIGHT) || (stereoMode == C_STEREO_PASSIVE_TOP_BOTTOM);
+    bool singlePass = a_singlePass && passive && (sphereBatch != nullptr);
+    cStereoMode eyes = singlePass ? stereoMode : C_STEREO_DISABLED;
+
+    camera->setStereoMode(singlePass ? C_STEREO_DISABLED : stereoMode);
+    stereoOverlay->setStereoMode(eyes);
+    if (sphereBatch != nullptr)
+    {
+        sphereBatch->setStereoMode(eyes);
+    }
+    singlePassStereo = a_singlePass;
+}
+
+//------------------------------------------------------------------------------
+
+bool createOffscreenBuffer(int a_width, int a_height)
+{
+    // the driver may support less than MAX_OFFSCREEN_SIZE
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxSize);
+    if ((a_width <= 0) || (a_height <= 0) || (a_width > maxSize) || (a_height > maxSize))
+    {
+        cout << "Error: offscreen framebuffer size " << a_width << "x" << a_height <<
+                " is not supported (maximum " << maxSize << ")" << endl;
+        return (false);
+    }
+
+    // create color and depth attachments
+    glGenRenderbuffers(1, &offscreenColorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, offscreenColorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, a_width, a_height);
+
+    glGenRenderbuffers(1, &offscreenDepthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, offscreenDepthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, a_width, a_height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    // create framebuffer object
+    glGenFramebuffers(1, &offscreenFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, offscreenFbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreenColorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, offscreenDepthBuffer);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        destroyOffscreenBuffer();
+        return (false);
+    }
+
+    // create pixel buffers for asynchronous readback
+    glGenBuffers(NUM_READBACK_BUFFERS, readbackBuffers);
+    for (int i = 0; i < NUM_READBACK_BUFFERS; i++)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 4 * a_width * a_height, NULL, GL_STREAM_READ);
+        readbackFrames[i] = -1;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readbackHead = 0;
+
+    return (true);
+}
+
+//------------------------------------------------------------------------------
+
+void destroyOffscreenBuffer(void)
+{
+    if (readbackBuffers[0] != 0)
+    {
+        glDeleteBuffers(NUM_READBACK_BUFFERS, readbackBuffers);
+        for (int i = 0; i < NUM_READBACK_BUFFERS; i++)
+        {
+            readbackBuffers[i] = 0;
+            readbackFrames[i] = -1;
+        }
+    }
+    if (offscreenFbo != 0)
+    {
+        glDeleteFramebuffers(1, &offscreenFbo);
+        offscreenFbo = 0;
+    }
+    if (offscreenColorBuffer != 0)
+    {
+        glDeleteRenderbuffers(1, &offscreenColorBuffer);
+        offscreenColorBuffer = 0;
+    }
+    if (offscreenDepthBuffer != 0)
+    {
+        glDeleteRenderbuffers(1, &offscreenDepthBuffer);
+        offscreenDepthBuffer = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void queueFrameReadback(int a_frame)
+{
+    // the oldest readback was issued NUM_READBACK_BUFFERS - 1 frames ago,
+    // so mapping it here normally does not wait for the GPU
+    collectFrameReadback(readbackHead);
+
+    // copy the current frame into a pixel buffer; glReadPixels returns immediately
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[readbackHead]);
+    glReadPixels(0, 0, offscreenW, offscreenH, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    readbackFrames[readbackHead] = a_frame;
+    readbackHead = (readbackHead + 1) % NUM_READBACK_BUFFERS;
+}
+
+//------------------------------------------------------------------------------
+
+void collectFrameReadback(int a_buffer)
+{
+    // nothing pending in this buffer
+    if (readbackFrames[a_buffer] < 0) { return; }
+
+    int frame = readbackFrames[a_buffer];
+    readbackFrames[a_buffer] = -1;
+
+    // drop the frame if the writer thread is falling behind
+    captureMutex.acquire();
+    bool full = (captureQueue.size() >= MAX_PENDING_CAPTURES);
+    captureMutex.release();
+    if (full)
+    {
+        captureDropped++;
+        return;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[a_buffer]);
+    const unsigned char* pixels = (const unsigned char*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (pixels != NULL)
+    {
+        // copy pixels into an image, flipping rows since OpenGL starts at the bottom
+        cImagePtr image = cImage::create();
+        image->allocate(offscreenW, offscreenH, GL_RGBA);
+        int rowSize = 4 * offscreenW;
+        unsigned char* data = image->getData();
+        for (int row = 0; row < offscreenH; row++)
+        {
+            memcpy(data + row * rowSize, pixels + (offscreenH - 1 - row) * rowSize, rowSize);
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+        // hand the image over to the writer thread
+        CapturedFrame capturedFrame;
+        capturedFrame.index = frame;
+        capturedFrame.image = image;
+        captureMutex.acquire();
+        captureQueue.push_back(capturedFrame);
+        captureMutex.release();
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+//------------------------------------------------------------------------------
+
+void flushFrameReadbacks(void)
+{
+    for (int i = 0; i < NUM_READBACK_BUFFERS; i++)
+    {
+        collectFrameReadback((readbackHead + i) % NUM_READBACK_BUFFERS);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void writeCapturedFrames(void)
+{
+    while (true)
+    {
+        // get next frame to write
+        CapturedFrame capturedFrame;
+        bool available = false;
+        captureMutex.acquire();
+        if (!captureQueue.empty())
+        {
+            capturedFrame = captureQueue.front();
+            captureQueue.pop_front();
+            available = true;
+        }
+        captureMutex.release();
+
+        if (!available)
+        {
+            // exit once the render loop has stopped and the queue is drained
+            if (!captureRunning) { break; }
+            cSleepMs(1);
+            continue;
+        }
+
+        // encode and write image
+        char filename[64];
+        snprintf(filename, sizeof(filename), "frame-%05d.png", capturedFrame.index);
+        if (!capturedFrame.image->saveToFile(filename))
+        {
+            cout << "Error: failed to write " << filename << endl;
+        }
+    }
+
+    captureFinished = true;
+}
+
+//------------------------------------------------------------------------------
+
+void cTimestampProbe::render(cRenderOptions& a_options)
+{
+    if (m_frontLayer)
+    {
+        profilerMark(MARK_FRONT_LAYER_BEGIN);
+    }
+    else if (SECTION_RENDER_OPAQUE_PARTS_ONLY(a_options))
+    {
+        profilerMark(MARK_OPAQUE_BEGIN);
+    }
+    else
+    {
+        // first pass over transparent back or front faces
+        profilerMark(MARK_TRANSPARENT_BEGIN);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void setProfilerEnabled(bool a_enabled)
+{
+    if ((a_enabled == profilerEnabled) || (a_enabled && !profilerSupported)) { return; }
+
+    if (a_enabled)
+    {
+        glGenQueries(PROFILER_LATENCY * NUM_PROFILER_MARKS, &profilerQueries[0][0]);
+        for (int i = 0; i < PROFILER_LATENCY; i++)
+        {
+            profilerFrameIndex[i] = -1;
+            for (int j = 0; j < NUM_PROFILER_MARKS; j++)
+            {
+                profilerIssued[i][j] = false;
+            }
+        }
+        profilerFrame = 0;
+        profilerHistoryCount = 0;
+    }
+    else
+    {
+        glDeleteQueries(PROFILER_LATENCY * NUM_PROFILER_MARKS, &profilerQueries[0][0]);
+    }
+
+    profilerEnabled = a_enabled;
+    scopeProfiler->setShowEnabled(a_enabled);
+    labelProfiler->setShowEnabled(a_enabled);
+}
+
+//------------------------------------------------------------------------------
+
+void profilerBeginFrame(void)
+{
+    if (!profilerEnabled) { return; }
+
+    int slot = profilerFrame % PROFILER_LATENCY;
+
+    // read back the frame that was issued PROFILER_LATENCY frames ago; if its last
+    // timestamp is not yet available, the frame is skipped rather than waited for
+    if (profilerFrameIndex[slot] >= 0)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(profilerQueries[slot][MARK_SWAP_END], GL_QUERY_RESULT_AVAILABLE, &available);
+
+        if (available && profilerIssued[slot][MARK_FRAME_BEGIN] && profilerIssued[slot][MARK_SWAP_END])
+        {
+            GLuint64 timestamp[NUM_PROFILER_MARKS];
+            for (int j = 0; j < NUM_PROFILER_MARKS; j++)
+            {
+                timestamp[j] = 0;
+                if (profilerIssued[slot][j])
+                {
+                    glGetQueryObjectui64v(profilerQueries[slot][j], GL_QUERY_RESULT, &timestamp[j]);
+                }
+            }
+
+            // passes that did not occur in this frame end where the next one begins
+            if (!profilerIssued[slot][MARK_OPAQUE_BEGIN])      { timestamp[MARK_OPAQUE_BEGIN] = timestamp[MARK_SHADOWS_END]; }
+            if (!profilerIssued[slot][MARK_FRONT_LAYER_BEGIN]) { timestamp[MARK_FRONT_LAYER_BEGIN] = timestamp[MARK_RENDER_END]; }
+            if (!profilerIssued[slot][MARK_TRANSPARENT_BEGIN]) { timestamp[MARK_TRANSPARENT_BEGIN] = timestamp[MARK_FRONT_LAYER_BEGIN]; }
+
+            int entry = profilerHistoryCount % PROFILER_HISTORY;
+            double* pass = profilerHistory[entry];
+            pass[PASS_SHADOWS]     = 1e-6 * (double)(timestamp[MARK_SHADOWS_END] - timestamp[MARK_FRAME_BEGIN]);
+            pass[PASS_OPAQUE]      = 1e-6 * (double)(timestamp[MARK_TRANSPARENT_BEGIN] - timestamp[MARK_OPAQUE_BEGIN]);
+            pass[PASS_TRANSPARENT] = 1e-6 * (double)(timestamp[MARK_FRONT_LAYER_BEGIN] - timestamp[MARK_TRANSPARENT_BEGIN]);
+            pass[PASS_FRONT_LAYER] = 1e-6 * (double)(timestamp[MARK_RENDER_END] - timestamp[MARK_FRONT_LAYER_BEGIN]);
+            pass[PASS_SWAP]        = 1e-6 * (double)(timestamp[MARK_SWAP_END] - timestamp[MARK_RENDER_END]);
+            profilerHistoryFrame[entry] = profilerFrameIndex[slot];
+            profilerHistoryCount++;
+        }
+    }
+
+    // reuse slot for the new frame
+    for (int j = 0; j < NUM_PROFILER_MARKS; j++)
+    {
+        profilerIssued[slot][j] = false;
+    }
+    profilerFrameIndex[slot] = profilerFrame;
+    profilerFrame++;
+}
+
+//------------------------------------------------------------------------------
+
+void profilerMark(int a_mark)
+{
+    if (!profilerEnabled) { return; }
+
+    // only the first occurrence of a mark in a frame is recorded (stereo renders twice)
+    int slot = (profilerFrame - 1) % PROFILER_LATENCY;
+    if (profilerIssued[slot][a_mark]) { return; }
+
+    glQueryCounter(profilerQueries[slot][a_mark], GL_TIMESTAMP);
+    profilerIssued[slot][a_mark] = true;
+}
+
+//------------------------------------------------------------------------------
+
+void updateProfilerWidgets(int a_displayW, int a_displayH)
+{
+    if (!profilerEnabled || (profilerHistoryCount == 0)) { return; }
+
+    // plot passes stacked on top of each other
+    double* pass = profilerHistory[(profilerHistoryCount - 1) % PROFILER_HISTORY];
+    double stack0 = pass[PASS_SHADOWS];
+    double stack1 = stack0 + pass[PASS_OPAQUE];
+    double stack2 = stack1 + pass[PASS_TRANSPARENT];
+    double stack3 = stack2 + pass[PASS_FRONT_LAYER] + pass[PASS_SWAP];
+    scopeProfiler->setSignalValues(stack0, stack1, stack2, stack3);
+
+    // average pass durations over the last frames
+    int count = cMin(profilerHistoryCount, 60);
+    string text;
+    for (int j = 0; j < NUM_PROFILER_PASSES; j++)
+    {
+        double sum = 0.0;
+        for (int i = 0; i < count; i++)
+        {
+            sum += profilerHistory[(profilerHistoryCount - 1 - i) % PROFILER_HISTORY][j];
+        }
+        text += string(profilerPassNames[j]) + " " + cStr(sum / count, 2) + " ms   ";
+    }
+    labelProfiler->setText(text);
+
+    // place widgets at the top left corner of the display
+    scopeProfiler->setLocalPos(10, a_displayH - 130);
+    labelProfiler->setLocalPos(10, a_displayH - 155);
+}
+
+//------------------------------------------------------------------------------
+
+void exportProfilerHistory(const string& a_filename)
+{
+    FILE* file = fopen(a_filename.c_str(), "w");
+    if (file == NULL)
+    {
+        cout << "Error: failed to open " << a_filename << endl;
+        return;
+    }
+
+    fprintf(file, "frame,shadows_ms,opaque_ms,transparent_ms,front_layer_ms,swap_ms,total_ms\n");
+
+    int count = cMin(profilerHistoryCount, PROFILER_HISTORY);
+    for (int i = profilerHistoryCount - count; i < profilerHistoryCount; i++)
+    {
+        int entry = i % PROFILER_HISTORY;
+        double total = 0.0;
+        fprintf(file, "%d", profilerHistoryFrame[entry]);
+        for (int j = 0; j < NUM_PROFILER_PASSES; j++)
+        {
+            fprintf(file, ",%.4f", profilerHistory[entry][j]);
+            total += profilerHistory[entry][j];
+        }
+        fprintf(file, ",%.4f\n", total);
+    }
+
+    fclose(file);
+    cout << "exported " << count << " frames to " << a_filename << endl;
+}
+
+//------------------------------------------------------------------------------
+
+double traceRecord(int a_thread, const char* a_name, double a_begin)
+{
+    double end = simClock.getCurrentTimeSeconds();
+
+    // single writer: the event is stored before the count is published
+    TraceBuffer& buffer = traceBuffers[a_thread];
+    uint64_t count = buffer.count.load(memory_order_relaxed);
+    TraceEvent& event = buffer.events[count % TRACE_CAPACITY];
+    event.name = a_name;
+    event.begin = a_begin;
+    event.end = end;
+    buffer.count.store(count + 1, memory_order_release);
+
+    return (end);
+}
+
+//------------------------------------------------------------------------------
+
+void exportTrace(const string& a_filename)
+{
+    FILE* file = fopen(a_filename.c_str(), "w");
+    if (file == NULL)
+    {
+        cout << "Error: failed to open " << a_filename << endl;
+        return;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    int total = 0;
+    vector<TraceEvent> events;
+    events.reserve(TRACE_CAPACITY);
+    for (int i = 0; i < NUM_TRACE_THREADS; i++)
+    {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                (i == 0) ? "" : ",\n", i, traceThreadNames[i]);
+
+        // copy the ring while its thread keeps recording
+        TraceBuffer& buffer = traceBuffers[i];
+        uint64_t count = buffer.count.load(memory_order_acquire);
+        uint64_t first = (count > TRACE_CAPACITY) ? count - TRACE_CAPACITY : 0;
+        events.clear();
+        for (uint64_t j = first; j < count; j++)
+        {
+            events.push_back(buffer.events[j % TRACE_CAPACITY]);
+        }
+
+        // drop the events that may have been overwritten during the copy
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t after = buffer.count.load(memory_order_relaxed);
+        uint64_t oldestSafe = (after >= TRACE_CAPACITY) ? after - TRACE_CAPACITY + 1 : 0;
+        size_t skip = (oldestSafe > first) ? (size_t)cMin(oldestSafe - first, (uint64_t)events.size()) : 0;
+
+        for (size_t j = skip; j < events.size(); j++)
+        {
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    events[j].name, i, 1e6 * events[j].begin, 1e6 * (events[j].end - events[j].begin));
+        }
+        total += (int)(events.size() - skip);
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    cout << "exported " << total << " trace events to " << a_filename << endl;
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t computeContactMask(void)
+{
+    uint32_t mask = 0;
+    unsigned int numEvents = tool->m_hapticPoint->getNumInteractionEvents();
+    for (unsigned int i = 0; i < numEvents; i++)
+    {
+        cGenericObject* object = tool->m_hapticPoint->getInteractionEvent(i)->m_object;
+        for (unsigned int j = 0; (j < sceneObjects.size()) && (j < MAX_METRIC_OBJECTS); j++)
+        {
+            if (sceneObjects[j].shape == object)
+            {
+                mask |= 1u << j;
+            }
+        }
+    }
+    return (mask);
+}
+
+//------------------------------------------------------------------------------
+
+void updateHapticStats(HapticStats& a_stats, double a_loopTime, double a_timeStep,
+                       const cVector3d& a_force, uint32_t a_contacts)
+{
+    a_stats.ticks++;
+
+    // tick duration; a tick longer than the time step falls behind real time
+    int bucket = 0;
+    while ((bucket < NUM_LATENCY_BUCKETS - 1) && (a_loopTime > metricsLatencyBounds[bucket])) { bucket++; }
+    a_stats.latencyBuckets[bucket]++;
+    a_stats.latencySum += a_loopTime;
+    if (a_loopTime > a_timeStep)
+    {
+        a_stats.overruns++;
+    }
+
+    // force saturation events (transitions into saturation)
+    bool saturated = (deviceMaxLinearForce > 0.0) && (a_force.length() >= deviceMaxLinearForce);
+    if (saturated && !a_stats.saturated)
+    {
+        a_stats.saturations++;
+    }
+    a_stats.saturated = saturated;
+
+    // contact events per object (transitions into contact)
+    for (int j = 0; j < MAX_METRIC_OBJECTS; j++)
+    {
+        bool inContact = (a_contacts & (1u << j)) != 0;
+        if (inContact && !a_stats.inContact[j])
+        {
+            a_stats.contacts[j]++;
+        }
+        a_stats.inContact[j] = inContact;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void publishHapticMetrics(const HapticStats& a_stats)
+{
+    hapticMetrics.rate.store(freqCounterHaptics.getFrequency(), memory_order_relaxed);
+    hapticMetrics.ticks.store(a_stats.ticks, memory_order_relaxed);
+    hapticMetrics.overruns.store(a_stats.overruns, memory_order_relaxed);
+    hapticMetrics.saturations.store(a_stats.saturations, memory_order_relaxed);
+    for (int i = 0; i < NUM_LATENCY_BUCKETS; i++)
+    {
+        hapticMetrics.latencyBuckets[i].store(a_stats.latencyBuckets[i], memory_order_relaxed);
+    }
+    hapticMetrics.latencySum.store(a_stats.latencySum, memory_order_relaxed);
+    for (int i = 0; i < MAX_METRIC_OBJECTS; i++)
+    {
+        hapticMetrics.contacts[i].store(a_stats.contacts[i], memory_order_relaxed);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+string formatMetrics(void)
+{
+    char line[256];
+    string text;
+
+    text += "# HELP commsome_haptic_rate_hz Haptic loop rate.\n";
+    text += "# TYPE commsome_haptic_rate_hz gauge\n";
+    snprintf(line, sizeof(line), "commsome_haptic_rate_hz %.1f\n", hapticMetrics.rate.load(memory_order_relaxed));
+    text += line;
+
+    text += "# HELP commsome_graphics_rate_hz Graphic loop rate.\n";
+    text += "# TYPE commsome_graphics_rate_hz gauge\n";
+    snprintf(line, sizeof(line), "commsome_graphics_rate_hz %.1f\n", graphicsMetrics.rate.load(memory_order_relaxed));
+    text += line;
+
+    text += "# HELP commsome_graphics_frames_total Frames rendered.\n";
+    text += "# TYPE commsome_graphics_frames_total counter\n";
+    snprintf(line, sizeof(line), "commsome_graphics_frames_total %llu\n",
+             (unsigned long long)graphicsMetrics.frames.load(memory_order_relaxed));
+    text += line;
+
+    // bucket counts are stored per bucket and reported cumulatively
+    text += "# HELP commsome_haptic_tick_seconds Duration of a haptic tick.\n";
+    text += "# TYPE commsome_haptic_tick_seconds histogram\n";
+    uint64_t cumulative = 0;
+    for (int i = 0; i < NUM_LATENCY_BUCKETS; i++)
+    {
+        cumulative += hapticMetrics.latencyBuckets[i].load(memory_order_relaxed);
+        if (i < NUM_LATENCY_BUCKETS - 1)
+        {
+            snprintf(line, sizeof(line), "commsome_haptic_tick_seconds_bucket{le=\"%g\"} %llu\n",
+                     metricsLatencyBounds[i], (unsigned long long)cumulative);
+        }
+        else
+        {
+            snprintf(line, sizeof(line), "commsome_haptic_tick_seconds_bucket{le=\"+Inf\"} %llu\n",
+                     (unsigned long long)cumulative);
+        }
+        text += line;
+    }
+    snprintf(line, sizeof(line), "commsome_haptic_tick_seconds_sum %.6f\ncommsome_haptic_tick_seconds_count %llu\n",
+             hapticMetrics.latencySum.load(memory_order_relaxed), (unsigned long long)cumulative);
+    text += line;
+
+    text += "# HELP commsome_haptic_overruns_total Haptic ticks longer than the simulation time step.\n";
+    text += "# TYPE commsome_haptic_overruns_total counter\n";
+    snprintf(line, sizeof(line), "commsome_haptic_overruns_total %llu\n",
+             (unsigned long long)hapticMetrics.overruns.load(memory_order_relaxed));
+    text += line;
+
+    text += "# HELP commsome_force_saturations_total Times the output force reached the device maximum.\n";
+    text += "# TYPE commsome_force_saturations_total counter\n";
+    snprintf(line, sizeof(line), "commsome_force_saturations_total %llu\n",
+             (unsigned long long)hapticMetrics.saturations.load(memory_order_relaxed));
+    text += line;
+
+    text += "# HELP commsome_object_contacts_total Contacts between the tool and an object.\n";
+    text += "# TYPE commsome_object_contacts_total counter\n";
+    for (unsigned int i = 0; i < metricsObjectNames.size(); i++)
+    {
+        snprintf(line, sizeof(line), "commsome_object_contacts_total{object=\"%s\"} %llu\n",
+                 metricsObjectNames[i].c_str(), (unsigned long long)hapticMetrics.contacts[i].load(memory_order_relaxed));
+        text += line;
+    }
+
+    return (text);
+}
+
+//------------------------------------------------------------------------------
+
+void serveMetrics(void)
+{
+#ifndef _WIN32
+    // listen on the loopback interface only
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)metricsPort);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((server < 0) || (bind(server, (sockaddr*)&address, sizeof(address)) != 0) || (listen(server, 4) != 0))
+    {
+        cout << "Error: failed to serve metrics on port " << metricsPort << endl;
+        if (server >= 0) { ::close(server); }
+        metricsFinished = true;
+        return;
+    }
+
+    while (metricsRunning)
+    {
+        // wake up regularly to check for termination
+        pollfd descriptor = { server, POLLIN, 0 };
+        if (poll(&descriptor, 1, 200) <= 0) { continue; }
+
+        int client = accept(server, NULL, NULL);
+        if (client < 0) { continue; }
+
+        // an idle client must not block the server, nor its termination
+        pollfd incoming = { client, POLLIN, 0 };
+        if (poll(&incoming, 1, 1000) <= 0)
+        {
+            ::close(client);
+            continue;
+        }
+
+        // the request is not inspected: every path returns the metrics
+        char request[1024];
+        if (recv(client, request, sizeof(request), MSG_DONTWAIT) > 0)
+        {
+            string body = formatMetrics();
+            string response = "HTTP/1.0 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: " + to_string(body.size()) + "\r\n"
+                              "Connection: close\r\n\r\n" + body;
+            send(client, response.data(), response.size(), MSG_NOSIGNAL);
+        }
+        ::close(client);
+    }
+
+    ::close(server);
+#else
+    cout << "Error: the metrics endpoint is not supported on this platform" << endl;
+#endif
+
+    metricsFinished = true;
+}
+
+//------------------------------------------------------------------------------
+
+bool openSessionLog(const string& a_filename)
+{
+    logOutput = fopen(a_filename.c_str(), "wb");
+    if (logOutput == NULL)
+    {
+        cout << "Error: failed to open " << a_filename << endl;
+        return (false);
+    }
+
+    // column names
+    vector<string> names = { "time_us", "tool_x_um", "tool_y_um", "tool_z_um",
+                             "force_x_mN", "force_y_mN", "force_z_mN", "contacts" };
+    vector<string> objectNames(numDynamicObjects);
+    for (unsigned int i = 0; i < sceneObjects.size(); i++)
+    {
+        if (sceneObjects[i].poseIndex >= 0)
+        {
+            objectNames[sceneObjects[i].poseIndex] = sceneObjects[i].desc.name;
+        }
+    }
+    for (int i = 0; i < numDynamicObjects; i++)
+    {
+        names.push_back(objectNames[i] + "_x_um");
+        names.push_back(objectNames[i] + "_y_um");
+        names.push_back(objectNames[i] + "_z_um");
+    }
+    logColumns = (int)names.size();
+
+    uint32_t header[3] = { LOG_VERSION, logBuildCodec, (uint32_t)logColumns };
+    fwrite("CLOG", 1, 4, logOutput);
+    fwrite(header, sizeof(uint32_t), 3, logOutput);
+    for (int i = 0; i < logColumns; i++)
+    {
+        char name[32] = { 0 };
+        strncpy(name, names[i].c_str(), sizeof(name) - 1);
+        fwrite(name, 1, sizeof(name), logOutput);
+    }
+
+    // the chunks are allocated before the haptic thread starts
+    logChunks = new LogChunk[LOG_POOL];
+    for (int i = 0; i < LOG_POOL; i++)
+    {
+        logChunks[i].count = 0;
+    }
+
+    return (true);
+}
+
+//------------------------------------------------------------------------------
+
+void logSample(const PoseData& a_pose, const cVector3d& a_toolPos, const cVector3d& a_force, uint32_t a_contacts)
+{
+    // never wait for the writer thread: drop the sample if all chunks are full
+    uint64_t head = logHead.load(memory_order_relaxed);
+    if (head - logTail.load(memory_order_acquire) >= LOG_POOL)
+    {
+        logDropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+
+    LogChunk& chunk = logChunks[head % LOG_POOL];
+    int n = chunk.count;
+    chunk.values[0][n] = llround(1e6 * a_pose.time);
+    for (int i = 0; i < 3; i++)
+    {
+        chunk.values[1 + i][n] = llround(1e6 * a_toolPos(i));
+        chunk.values[4 + i][n] = llround(1e3 * a_force(i));
+    }
+    chunk.values[7][n] = a_contacts;
+    for (int j = 0; j < numDynamicObjects; j++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            chunk.values[LOG_FIXED_COLUMNS + 3 * j + i][n] = llround(1e6 * a_pose.objectPos[j](i));
+        }
+    }
+
+    // hand the chunk to the writer thread once full
+    chunk.count = n + 1;
+    if (chunk.count == LOG_CHUNK_SAMPLES)
+    {
+        logHead.store(head + 1, memory_order_release);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void writeSessionLog(void)
+{
+    // varints take at most 10 bytes per value
+    vector<uint8_t> encoded(10 * LOG_CHUNK_SAMPLES);
+#if defined(COMMSOME_LOG_CODEC_ZSTD)
+    vector<uint8_t> compressed(ZSTD_compressBound(encoded.size()));
+#elif defined(COMMSOME_LOG_CODEC_LZ4)
+    vector<uint8_t> compressed(LZ4_compressBound((int)encoded.size()));
+#else
+    vector<uint8_t> compressed;
+#endif
+
+    while (true)
+    {
+        // read the running flag first, so that the final chunk is not missed
+        bool running = logRunning;
+        uint64_t tail = logTail.load(memory_order_relaxed);
+        if (tail == logHead.load(memory_order_acquire))
+        {
+            if (!running) { break; }
+            cSleepMs(50);
+            continue;
+        }
+
+        LogChunk& chunk = logChunks[tail % LOG_POOL];
+        uint32_t count = chunk.count;
+        fwrite(&count, sizeof(uint32_t), 1, logOutput);
+
+        for (int c = 0; c < logColumns; c++)
+        {
+            // delta, zigzag and varint encoding
+            size_t size = 0;
+            int64_t previous = 0;
+            for (uint32_t i = 0; i < count; i++)
+            {
+                int64_t delta = chunk.values[c][i] - previous;
+                previous = chunk.values[c][i];
+                uint64_t value = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+                while (value >= 0x80)
+                {
+                    encoded[size++] = (uint8_t)(value | 0x80);
+                    value >>= 7;
+                }
+                encoded[size++] = (uint8_t)value;
+            }
+
+            // compress the column if it makes it smaller
+            const uint8_t* stored = encoded.data();
+            size_t storedSize = size;
+#if defined(COMMSOME_LOG_CODEC_ZSTD)
+            size_t result = ZSTD_compress(compressed.data(), compressed.size(), encoded.data(), size, 3);
+            if (!ZSTD_isError(result) && (result < size))
+            {
+                stored = compressed.data();
+                storedSize = result;
+            }
+#elif defined(COMMSOME_LOG_CODEC_LZ4)
+            int result = LZ4_compress_default((const char*)encoded.data(), (char*)compressed.data(),
+                                              (int)size, (int)compressed.size());
+            if ((result > 0) && ((size_t)result < size))
+            {
+                stored = compressed.data();
+                storedSize = result;
+            }
+#endif
+
+            uint32_t sizes[2] = { (uint32_t)size, (uint32_t)storedSize };
+            fwrite(sizes, sizeof(uint32_t), 2, logOutput);
+            fwrite(stored, 1, storedSize, logOutput);
+        }
+
+        // return the chunk to the haptic thread
+        chunk.count = 0;
+        logTail.store(tail + 1, memory_order_release);
+    }
+
+    fclose(logOutput);
+    logOutput = NULL;
+    logFinished = true;
+}
+
+//------------------------------------------------------------------------------
+
+bool dumpSessionLog(const string& a_filename)
+{
+    FILE* file = fopen(a_filename.c_str(), "rb");
+    if (file == NULL)
+    {
+        cout << "Error: failed to open " << a_filename << endl;
+        return (false);
+    }
+
+    char magic[4];
+    uint32_t header[3];
+    if ((fread(magic, 1, 4, file) != 4) || (memcmp(magic, "CLOG", 4) != 0) ||
+        (fread(header, sizeof(uint32_t), 3, file) != 3) || (header[0] != LOG_VERSION))
+    {
+        cout << "Error: " << a_filename << " is not a session log" << endl;
+        fclose(file);
+        return (false);
+    }
+    uint32_t codec = header[1];
+    if ((header[2] == 0) || (header[2] > (uint32_t)MAX_LOG_COLUMNS))
+    {
+        cout << "Error: " << a_filename << " is corrupted (" << header[2] << " columns)" << endl;
+        fclose(file);
+        return (false);
+    }
+    int columns = (int)header[2];
+
+    // a build reads uncompressed logs and logs written with its own codec
+    if (codec > LOG_CODEC_ZSTD_BLOCK)
+    {
+        cout << "Error: " << a_filename << " uses an unknown codec (" << codec << ")" << endl;
+        fclose(file);
+        return (false);
+    }
+    if ((codec != LOG_CODEC_NONE) && (codec != logBuildCodec))
+    {
+        cout << "Error: " << a_filename << " is compressed with " << logCodecNames[codec]
+             << ", but this build reads " << "uncompressed" << ((logBuildCodec == LOG_CODEC_NONE) ? "" : " and ")
+             << ((logBuildCodec == LOG_CODEC_NONE) ? "" : logCodecNames[logBuildCodec]) << " logs only; rebuild with " << logCodecOptions[codec] << endl;
+        fclose(file);
+        return (false);
+    }
+
+    // column names
+    for (int c = 0; c < columns; c++)
+    {
+        char name[33] = { 0 };
+        if (fread(name, 1, 32, file) != 32)
+        {
+            cout << "Error: " << a_filename << " is truncated" << endl;
+            fclose(file);
+            return (false);
+        }
+        printf("%s%s", (c == 0) ? "" : ",", name);
+    }
+    printf("\n");
+
+    vector<vector<int64_t> > values(columns);
+    vector<uint8_t> stored;
+    vector<uint8_t> encoded;
+    uint32_t count;
+    while (fread(&count, sizeof(uint32_t), 1, file) == 1)
+    {
+        // the writer never exceeds a chunk of samples, nor varints of 10 bytes,
+        // and stores a column as is when the codec does not make it smaller
+        if (count > (uint32_t)LOG_CHUNK_SAMPLES)
+        {
+            cout << "Error: " << a_filename << " is corrupted (chunk of " << count << " samples)" << endl;
+            fclose(file);
+            return (false);
+        }
+
+        for (int c = 0; c < columns; c++)
+        {
+            uint32_t sizes[2];
+            if (fread(sizes, sizeof(uint32_t), 2, file) != 2) { count = 0; break; }
+            if ((sizes[0] > 10 * count) || (sizes[1] > sizes[0]))
+            {
+                cout << "Error: " << a_filename << " is corrupted (column of " << sizes[1] << " bytes for "
+                     << sizes[0] << " encoded bytes and " << count << " samples)" << endl;
+                fclose(file);
+                return (false);
+            }
+            stored.resize(sizes[1]);
+            encoded.resize(sizes[0]);
+            if (fread(stored.data(), 1, sizes[1], file) != sizes[1]) { count = 0; break; }
+
+            // decompress the column (equal sizes mean the column is stored as is)
+            if (sizes[1] == sizes[0])
+            {
+                encoded = stored;
+            }
+#if defined(COMMSOME_LOG_CODEC_ZSTD)
+            else if ((codec == LOG_CODEC_ZSTD_BLOCK) &&
+                     (ZSTD_decompress(encoded.data(), sizes[0], stored.data(), sizes[1]) == sizes[0])) {}
+#elif defined(COMMSOME_LOG_CODEC_LZ4)
+            else if ((codec == LOG_CODEC_LZ4_BLOCK) &&
+                     (LZ4_decompress_safe((const char*)stored.data(), (char*)encoded.data(),
+                                          (int)sizes[1], (int)sizes[0]) == (int)sizes[0])) {}
+#endif
+            else
+            {
+                cout << "Error: " << a_filename << " is corrupted (a " << logCodecNames[codec] << " column does not decompress)" << endl;
+                fclose(file);
+                return (false);
+            }
+
+            // varint, zigzag and delta decoding
+            values[c].resize(count);
+            size_t position = 0;
+            int64_t previous = 0;
+            for (uint32_t i = 0; i < count; i++)
+            {
+                uint64_t value = 0;
+                int shift = 0;
+                while ((position < encoded.size()) && (encoded[position] & 0x80) && (shift < 64))
+                {
+                    value |= (uint64_t)(encoded[position++] & 0x7f) << shift;
+                    shift += 7;
+                }
+                if (shift >= 64)
+                {
+                    cout << "Error: " << a_filename << " is corrupted (varint longer than 64 bits)" << endl;
+                    fclose(file);
+                    return (false);
+                }
+                if (position < encoded.size())
+                {
+                    value |= (uint64_t)encoded[position++] << shift;
+                }
+                previous += (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+                values[c][i] = previous;
+            }
+        }
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            for (int c = 0; c < columns; c++)
+            {
+                printf("%s%lld", (c == 0) ? "" : ",", (long long)values[c][i]);
+            }
+            printf("\n");
+        }
+    }
+
+    fclose(file);
+    return (true);
+}
+
+//------------------------------------------------------------------------------
+
+bool playoutRemoteTool(double a_time, TeleopPacket& a_sample)
+{
+    // move received packets into the jitter buffer
+    TeleopArrival arrival;
+    while (teleopIncoming.pop(arrival))
+    {
+        uint32_t sequence = arrival.packet.sequence;
+        double offset = arrival.arrival - arrival.packet.time;
+
+        // first packet, or the remote station reconnected: restart the stream
+        if ((teleopLastArrival < 0.0) || (arrival.arrival - teleopLastArrival > TELEOP_TIMEOUT))
+        {
+            teleopJitterCount = 0;
+            teleopOffset = offset;
+            teleopHighest = sequence - 1;
+            teleopPlayed = sequence - 1;
+            teleopReceivedMask = 0;
+        }
+        teleopReceived++;
+        teleopLastArrival = arrival.arrival;
+
+        // the smallest observed delay tracks the clock offset plus the network
+        // delay; it is slowly released so that clock drift is followed
+        teleopOffset = (offset < teleopOffset) ? offset : teleopOffset + TELEOP_OFFSET_LEAK;
+
+        // count gaps in the sequence; a reordered packet fills a gap, and a
+        // duplicated packet is dropped without changing the count
+        if ((int32_t)(sequence - teleopHighest) > 0)
+        {
+            uint32_t advance = sequence - teleopHighest;
+            teleopLost += advance - 1;
+            teleopReceivedMask = (advance < 64) ? (teleopReceivedMask << advance) | 1 : 1;
+            teleopHighest = sequence;
+        }
+        else if (teleopHighest - sequence < 64)
+        {
+            uint64_t bit = (uint64_t)1 << (teleopHighest - sequence);
+            if (teleopReceivedMask & bit)
+            {
+                teleopDuplicates++;
+                continue;
+            }
+            teleopReceivedMask |= bit;
+            if (teleopLost > 0) { teleopLost--; }
+        }
+
+        // a packet older than the sample being played out arrived too late
+        if ((int32_t)(sequence - teleopPlayed) <= 0)
+        {
+            teleopLate++;
+            continue;
+        }
+
+        // insert in sequence order, dropping the oldest packet when full
+        int index = teleopJitterCount;
+        while ((index > 0) && ((int32_t)(teleopJitter[index - 1].packet.sequence - sequence) > 0)) { index--; }
+        if ((index > 0) && (teleopJitter[index - 1].packet.sequence == sequence)) { continue; }
+        if (teleopJitterCount == TELEOP_JITTER)
+        {
+            if (index == 0) { continue; }
+            memmove(&teleopJitter[0], &teleopJitter[1], (index - 1) * sizeof(TeleopArrival));
+            index--;
+        }
+        else
+        {
+            memmove(&teleopJitter[index + 1], &teleopJitter[index], (teleopJitterCount - index) * sizeof(TeleopArrival));
+            teleopJitterCount++;
+        }
+        teleopJitter[index] = arrival;
+    }
+
+    // nothing to play out, or the remote station is gone
+    if ((teleopJitterCount == 0) || (a_time - teleopLastArrival > TELEOP_TIMEOUT))
+    {
+        return (false);
+    }
+
+    // remote time played out now, delayed to absorb the jitter of the network
+    double target = a_time - teleopOffset - teleopJitterDelay;
+
+    // discard samples older than the pair bracketing the target time
+    int first = 0;
+    while ((first + 1 < teleopJitterCount) && (teleopJitter[first + 1].packet.time <= target)) { first++; }
+    if (first > 0)
+    {
+        memmove(&teleopJitter[0], &teleopJitter[first], (teleopJitterCount - first) * sizeof(TeleopArrival));
+        teleopJitterCount -= first;
+    }
+    teleopPlayed = teleopJitter[0].packet.sequence;
+
+    // the buffer ran dry: hold the latest position; waves are not repeated, so
+    // that the link does not receive energy that was never sent
+    const TeleopPacket& older = teleopJitter[0].packet;
+    if (teleopJitterCount == 1)
+    {
+        if (target > older.time) { teleopUnderruns++; }
+        a_sample = older;
+        for (int i = 0; i < 3; i++)
+        {
+            a_sample.wave[i] = 0.0f;
+            a_sample.returnWave[i] = 0.0f;
+        }
+        return (true);
+    }
+
+    // interpolate between the bracketing samples
+    const TeleopPacket& newer = teleopJitter[1].packet;
+    double dt = newer.time - older.time;
+    float t = (float)((dt > 0.0) ? cClamp((target - older.time) / dt, 0.0, 1.0) : 1.0);
+    a_sample = older;
+    for (int i = 0; i < 3; i++)
+    {
+        a_sample.position[i] += t * (newer.position[i] - older.position[i]);
+        a_sample.force[i] += t * (newer.force[i] - older.force[i]);
+        a_sample.wave[i] += t * (newer.wave[i] - older.wave[i]);
+        a_sample.returnWave[i] += t * (newer.returnWave[i] - older.returnWave[i]);
+    }
+    return (true);
+}
+
+//------------------------------------------------------------------------------
+
+cVector3d computeWaveCoupling(const TeleopPacket& a_remote, bool a_active, const cVector3d& a_toolPos,
+                              const cVector3d& a_toolVel, double a_dt, TeleopPacket& a_outgoing)
+{
+    double b = teleopImpedance;
+    double sqrt2b = sqrt(2.0 * b);
 
-    double mass = 0.5;
-    double damping = 0.0;
+    // without a remote station, the master sends its velocity and feels no force
+    if (!a_active)
+    {
+        teleopCoupled = false;
+        for (int i = 0; i < 3; i++)
+        {
+            a_outgoing.wave[i] = (float)(sqrt2b * a_toolVel(i));
+            a_outgoing.returnWave[i] = 0.0f;
+        }
+        return (cVector3d(0.0, 0.0, 0.0));
+    }
 
-    cVector3d object2StartPos(0.0, 1.0, 0.0);
-    cVector3d object2Vel(0.0, 0.0, 0.0);
+    // start the proxy at the remote tool position
+    cVector3d remotePos(a_remote.position[0], a_remote.position[1], a_remote.position[2]);
+    if (!teleopCoupled)
+    {
+        remoteProxyPos = remotePos;
+        teleopWaveIn.zero();
+        teleopReturnIn.zero();
+        teleopCoupled = true;
+    }
 
-    double oscTime0 = 0.0;
-    double oscTime3 = 0.0;
+    // low-pass filter the received waves
+    double alpha = 1.0 - exp(-2.0 * C_PI * TELEOP_WAVE_CUTOFF * a_dt);
+    cVector3d waveIn(a_remote.wave[0], a_remote.wave[1], a_remote.wave[2]);
+    cVector3d returnIn(a_remote.returnWave[0], a_remote.returnWave[1], a_remote.returnWave[2]);
+    teleopWaveIn += alpha * (waveIn - teleopWaveIn);
+    teleopReturnIn += alpha * (returnIn - teleopReturnIn);
+
+    // slave: the proxy of the remote tool pushes the local tool on contact
+    cVector3d contactForce(0.0, 0.0, 0.0);
+    cVector3d dir = a_toolPos - remoteProxyPos;
+    double dist = dir.length();
+    double penetration = 2.0 * tool->getRadius() - dist;
+    if ((penetration > 0.0) && (dist > C_SMALL))
+    {
+        contactForce = (teleopStiffness * penetration / dist) * dir;
+    }
 
-    while (simulationRunning)
+    // the proxy follows the received wave and yields to the contact force
+    cVector3d proxyVel = (sqrt2b * teleopWaveIn - contactForce) / b;
+    remoteProxyPos += a_dt * proxyVel;
+    if (penetration <= 0.0)
     {
-        world->computeGlobalPositions(true);
-        tool->updateFromDevice();
-        tool->computeInteractionForces();
+        // the velocity-based link drifts; a free proxy is pulled back to the remote tool
+        remoteProxyPos += (TELEOP_DRIFT_GAIN * a_dt) * (remotePos - remoteProxyPos);
+    }
+    cVector3d returnOut = teleopWaveIn - sqrt(2.0 / b) * contactForce;
 
-        cVector3d toolPos = tool->getDeviceGlobalPos();
-        cVector3d baseForce = tool->getDeviceGlobalForce(); // base haptic feedback
+    // master: the local tool feels the force returned by its proxy at the remote station
+    cVector3d masterForce = b * a_toolVel - sqrt2b * teleopReturnIn;
+    cVector3d waveOut = sqrt2b * a_toolVel - teleopReturnIn;
 
-        // --- Object0 vibration ---
-        {
-            cVector3d objPos = object0->getGlobalPos();
-            cVector3d dir = objPos - toolPos;
-            double dist = dir.length();
-            double radiusSum = 0.05 + object0->getRadius();
+    for (int i = 0; i < 3; i++)
+    {
+        a_outgoing.wave[i] = (float)waveOut(i);
+        a_outgoing.returnWave[i] = (float)returnOut(i);
+    }
 
-            if (dist < radiusSum)
-            {
-                // read linear velocity 
-                cVector3d linearVelocity = tool->getDeviceGlobalLinVel();
+    return (contactForce - masterForce);
+}
 
-                // compute linear damping force
-                double Kv = 0.1;
-                cVector3d forceDamping = Kv * linearVelocity;
-                baseForce.add(forceDamping);
-                baseForce *= 4;
-            }
+//------------------------------------------------------------------------------
+
+void runTeleopNetwork(void)
+{
+#ifndef _WIN32
+    // resolve the remote station
+    string host = teleopPeer.substr(0, teleopPeer.rfind(':'));
+    string port = teleopPeer.substr(teleopPeer.rfind(':') + 1);
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* peer = NULL;
+    if ((teleopPeer.find(':') == string::npos) || (getaddrinfo(host.c_str(), port.c_str(), &hints, &peer) != 0))
+    {
+        cout << "Error: failed to resolve teleoperation peer " << teleopPeer << endl;
+        teleopFinished = true;
+        return;
+    }
+
+    // bind the local port
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)teleopPort);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if ((sock < 0) || (bind(sock, (sockaddr*)&address, sizeof(address)) != 0))
+    {
+        cout << "Error: failed to bind teleoperation port " << teleopPort << endl;
+        if (sock >= 0) { ::close(sock); }
+        freeaddrinfo(peer);
+        teleopFinished = true;
+        return;
+    }
 
+    // packets held back by the artificial delay
+    deque<TeleopArrival> delayed;
+
+    while (teleopRunning)
+    {
+        // send the packets queued by the haptic thread, once their delay has elapsed
+        TeleopArrival outgoing;
+        while (teleopOutgoing.pop(outgoing))
+        {
+            delayed.push_back(outgoing);
+        }
+        double now = simClock.getCurrentTimeSeconds();
+        while (!delayed.empty() && (delayed.front().arrival + teleopDelay <= now))
+        {
+            sendto(sock, &delayed.front().packet, sizeof(TeleopPacket), 0, peer->ai_addr, peer->ai_addrlen);
+            delayed.pop_front();
         }
 
-        // --- Object3 vibration ---
+        // wait for packets, at most one send period
+        pollfd descriptor = { sock, POLLIN, 0 };
+        if (poll(&descriptor, 1, 1) <= 0) { continue; }
+
+        // receive all pending packets
+        TeleopArrival incoming;
+        while (recv(sock, &incoming.packet, sizeof(TeleopPacket), MSG_DONTWAIT) == (ssize_t)sizeof(TeleopPacket))
         {
-            cVector3d objPos = object3->getGlobalPos();
-            cVector3d dir = objPos - toolPos;
-            double dist = dir.length();
-            double radiusSum = inLoop ?
-                0.05 + object3->getRadius() * 2 :
-                (0.05 + object3->getRadius()) ;
+            if (incoming.packet.magic != TELEOP_MAGIC) { continue; }
+            incoming.arrival = simClock.getCurrentTimeSeconds();
+            teleopIncoming.push(incoming);
+        }
+    }
 
-            if (dist < radiusSum)
-            {
-                oscTime3 += timeStep;
-                double f = amp * sin(2.0 * 3.14159 * freq * oscTime3);
-                double f2 = amp * cos(2.0 * 3.14159 * freq * oscTime3);
-                baseForce += cVector3d(-f2, f, f2);
+    ::close(sock);
+    freeaddrinfo(peer);
+#else
+    cout << "Error: teleoperation is not supported on this platform" << endl;
+#endif
 
-                inLoop = true;
-            }
-            else
+    teleopFinished = true;
+}
+
+//------------------------------------------------------------------------------
+
+void reportSceneEvents(void)
+{
+    SceneEvent events[64];
+    int count = sceneStateReader.readEvents(events, 64);
+    for (int i = 0; i < count; i++)
+    {
+        const SceneEvent& event = events[i];
+        const char* object = ((event.object >= 0) && (event.object < (int)sceneObjects.size())) ?
+                             sceneObjects[event.object].desc.name : "";
+        switch (event.type)
+        {
+            case SCENE_EVENT_CONTACT_BEGIN:       cout << "contact with " << object << endl; break;
+            case SCENE_EVENT_CONTACT_END:         cout << "contact with " << object << " ended" << endl; break;
+            case SCENE_EVENT_PARAMS_RELOADED:     cout << "haptic parameters reloaded" << endl; break;
+            case SCENE_EVENT_REMOTE_CONNECTED:    cout << "remote station connected" << endl; break;
+            case SCENE_EVENT_REMOTE_DISCONNECTED: cout << "remote station disconnected" << endl; break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool loadViscosityField(const string& a_filename, double a_maxDamping, VoxelField& a_field)
+{
+    /*
+        text file, one command per line; '#' starts a comment:
+          grid <x,y,z> <spacing> <nx,ny,nz>     position of the first sample, distance
+                                                between samples [m] and number of samples
+          box <x,y,z> <x,y,z> <viscosity> [<vx,vy,vz>]
+                                                uniform viscosity and current in a box
+          ball <x,y,z> <radius> <viscosity> [<vx,vy,vz>]
+                                                viscosity and current fading linearly
+                                                from the center to the surface
+        regions add up; viscosities are fractions of the maximum damping of the device
+    */
+    FILE* file = fopen(a_filename.c_str(), "r");
+    if (file == NULL) { return (false); }
+
+    // samples are accumulated in a dense grid, then stored in bricks
+    vector<FieldSample> dense;
+    double spacing = 0.0;
+    int lineNumber = 0;
+    char line[256];
+    bool result = true;
+    while (result && fgets(line, sizeof(line), file))
+    {
+        lineNumber++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL) { *comment = 0; }
+
+        char command[16];
+        if (sscanf(line, "%15s", command) != 1) { continue; }
+
+        double x0, y0, z0, x1, y1, z1, value, vx = 0.0, vy = 0.0, vz = 0.0;
+        int nx, ny, nz;
+        if (strcmp(command, "grid") == 0)
+        {
+            result = (sscanf(line, "%*s %lf,%lf,%lf %lf %d,%d,%d", &x0, &y0, &z0, &spacing, &nx, &ny, &nz) == 7) &&
+                     dense.empty() && (spacing > 0.0) && (nx >= 2) && (ny >= 2) && (nz >= 2) &&
+                     ((double)nx * ny * nz <= 64.0 * 1024 * 1024);
+            if (result)
             {
-                oscTime3 = 0.0;
-                inLoop = false;
+                a_field.origin.set(x0, y0, z0);
+                a_field.invVoxelSize = 1.0 / spacing;
+                a_field.size[0] = nx;
+                a_field.size[1] = ny;
+                a_field.size[2] = nz;
+                FieldSample zero = { 0.0f, { 0.0f, 0.0f, 0.0f } };
+                dense.assign((size_t)nx * ny * nz, zero);
             }
         }
-
-        // --- Object2 dynamics ---
+        else if ((strcmp(command, "box") == 0) || (strcmp(command, "ball") == 0))
         {
-            cVector3d objPos = object2->getGlobalPos();
-            cVector3d dir = objPos - toolPos;
-            double dist = dir.length();
-            double radiusSum = 0.03 + object2->getRadius();
-
-            if (dist < radiusSum)
+            bool box = (command[1] == 'o');
+            int count = box ?
+                sscanf(line, "%*s %lf,%lf,%lf %lf,%lf,%lf %lf %lf,%lf,%lf", &x0, &y0, &z0, &x1, &y1, &z1, &value, &vx, &vy, &vz) :
+                sscanf(line, "%*s %lf,%lf,%lf %lf %lf %lf,%lf,%lf", &x0, &y0, &z0, &x1, &value, &vx, &vy, &vz);
+            int required = box ? 7 : 5;
+            result = !dense.empty() && ((count == required) || (count == required + 3));
+            if (!result) { break; }
+
+            for (int k = 0; k < a_field.size[2]; k++)
             {
-                dir.normalize();
-                cVector3d netForce = -baseForce - damping * object2Vel;
-                object2Vel += (netForce / mass) * timeStep;
-                baseForce *= 10;
+                for (int j = 0; j < a_field.size[1]; j++)
+                {
+                    for (int i = 0; i < a_field.size[0]; i++)
+                    {
+                        cVector3d pos = a_field.origin + spacing * cVector3d(i, j, k);
+                        double weight;
+                        if (box)
+                        {
+                            bool inside = (pos(0) >= x0) && (pos(0) <= x1) && (pos(1) >= y0) &&
+                                          (pos(1) <= y1) && (pos(2) >= z0) && (pos(2) <= z1);
+                            weight = inside ? 1.0 : 0.0;
+                        }
+                        else
+                        {
+                            weight = cMax(0.0, 1.0 - (pos - cVector3d(x0, y0, z0)).length() / x1);
+                        }
+                        if (weight <= 0.0) { continue; }
+
+                        FieldSample& sample = dense[((size_t)k * a_field.size[1] + j) * a_field.size[0] + i];
+                        sample.viscosity += (float)(weight * value * a_maxDamping);
+                        sample.current[0] += (float)(weight * vx);
+                        sample.current[1] += (float)(weight * vy);
+                        sample.current[2] += (float)(weight * vz);
+                    }
+                }
             }
+        }
+        else
+        {
+            result = false;
+        }
+    }
+    fclose(file);
+
+    if (!result || dense.empty())
+    {
+        cout << "Error: field line " << lineNumber << ": invalid command" << endl;
+        return (false);
+    }
 
-            object2->setLocalPos(object2->getLocalPos() + object2Vel * timeStep);
-            object2Vel *= 0.999;
+    // store the non-empty bricks; brick 0 is the empty brick
+    FieldSample zero = { 0.0f, { 0.0f, 0.0f, 0.0f } };
+    for (int axis = 0; axis < 3; axis++)
+    {
+        a_field.bricks[axis] = (a_field.size[axis] - 2) / FIELD_BRICK + 1;
+    }
+    a_field.brickIndex.assign(a_field.bricks[0] * a_field.bricks[1] * a_field.bricks[2], 0);
+    a_field.samples.assign(FIELD_BRICK_SAMPLES, zero);
 
-            if ((object2->getLocalPos() - object2StartPos).length() > 1.0)
+    vector<FieldSample> brick(FIELD_BRICK_SAMPLES);
+    for (int bz = 0; bz < a_field.bricks[2]; bz++)
+    {
+        for (int by = 0; by < a_field.bricks[1]; by++)
+        {
+            for (int bx = 0; bx < a_field.bricks[0]; bx++)
             {
-                object2Vel.set(0, 0, 0);
-                object2->setLocalPos(object2StartPos);
+                // samples beyond the grid repeat its last sample; overlapping regions
+                // may add up beyond the damping the device can render stably, so the
+                // viscosity of each sample is limited to the maximum damping
+                bool empty = true;
+                for (int k = 0; k <= FIELD_BRICK; k++)
+                {
+                    for (int j = 0; j <= FIELD_BRICK; j++)
+                    {
+                        for (int i = 0; i <= FIELD_BRICK; i++)
+                        {
+                            int x = cMin(bx * FIELD_BRICK + i, a_field.size[0] - 1);
+                            int y = cMin(by * FIELD_BRICK + j, a_field.size[1] - 1);
+                            int z = cMin(bz * FIELD_BRICK + k, a_field.size[2] - 1);
+                            const FieldSample& sample = dense[((size_t)z * a_field.size[1] + y) * a_field.size[0] + x];
+                            FieldSample& stored = brick[(k * (FIELD_BRICK + 1) + j) * (FIELD_BRICK + 1) + i];
+                            stored = sample;
+                            stored.viscosity = cClamp(stored.viscosity, 0.0f, (float)a_maxDamping);
+                            empty = empty && (stored.viscosity == 0.0f);
+                        }
+                    }
+                }
+                if (empty) { continue; }
+
+                a_field.brickIndex[(bz * a_field.bricks[1] + by) * a_field.bricks[0] + bx] = (int32_t)a_field.samples.size();
+                a_field.samples.insert(a_field.samples.end(), brick.begin(), brick.end());
             }
         }
+    }
 
-        tool->setDeviceGlobalForce(baseForce);
-        tool->applyToDevice();
-        freqCounterHaptics.signal(1);
+    cout << "Viscosity field: " << (a_field.samples.size() / FIELD_BRICK_SAMPLES - 1) << " of " <<
+            a_field.brickIndex.size() << " bricks stored" << endl;
+
+    return (true);
+}
+
+//------------------------------------------------------------------------------
+
+cVector3d sampleViscosityField(const VoxelField& a_field, const cVector3d& a_pos, const cVector3d& a_vel)
+{
+    // grid coordinates, clamped to the grid; outside the grid, the weight is zero
+    double inside = 1.0;
+    int cell[3];
+    double t[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        double g = (a_pos(axis) - a_field.origin(axis)) * a_field.invVoxelSize;
+        double limit = a_field.size[axis] - 1;
+        inside *= (g >= 0.0) && (g <= limit);
+        g = cClamp(g, 0.0, limit - 1e-6);
+        cell[axis] = (int)g;
+        t[axis] = g - cell[axis];
     }
 
-    simulationFinished = true;
+    // the 8 samples around the point are in the same brick
+    const int32_t first = a_field.brickIndex[((cell[2] / FIELD_BRICK) * a_field.bricks[1] +
+                                              (cell[1] / FIELD_BRICK)) * a_field.bricks[0] +
+                                              (cell[0] / FIELD_BRICK)];
+    const int STRIDE_Y = FIELD_BRICK + 1;
+    const int STRIDE_Z = (FIELD_BRICK + 1) * (FIELD_BRICK + 1);
+    const FieldSample* s = &a_field.samples[first +
+                                            (cell[2] % FIELD_BRICK) * STRIDE_Z +
+                                            (cell[1] % FIELD_BRICK) * STRIDE_Y +
+                                            (cell[0] % FIELD_BRICK)];
+
+    // trilinear interpolation of viscosity and viscosity-weighted current
+    float values[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int corner = 0; corner < 8; corner++)
+    {
+        int dx = corner & 1;
+        int dy = (corner >> 1) & 1;
+        int dz = corner >> 2;
+        const FieldSample& sample = s[dz * STRIDE_Z + dy * STRIDE_Y + dx];
+        float weight = (float)((dx ? t[0] : 1.0 - t[0]) * (dy ? t[1] : 1.0 - t[1]) * (dz ? t[2] : 1.0 - t[2]));
+        float w = weight * sample.viscosity;
+        values[0] += w;
+        values[1] += w * sample.current[0];
+        values[2] += w * sample.current[1];
+        values[3] += w * sample.current[2];
+    }
+
+    // the medium drags the tool towards its own velocity
+    cVector3d drag = cVector3d(values[1], values[2], values[3]) - values[0] * a_vel;
+    return (inside * drag);
+}
+
+//------------------------------------------------------------------------------
+
+FusedEffect::FusedEffect(cGenericObject* a_parent, uint32_t a_effects) : cGenericEffect(a_parent)
+{
+    m_effects = a_effects;
+    m_sticking = false;
+    m_clock.start(true);
+}
+
+//------------------------------------------------------------------------------
+
+void FusedEffect::beginEvaluation(const cVector3d& a_toolPos, const cVector3d& a_toolVel, EffectContext& a_context)
+{
+    a_context.toolPos = a_toolPos;
+    a_context.toolVel = a_toolVel;
+    a_context.inside = m_parent->m_interactionInside;
+    a_context.toSurface = m_parent->m_interactionPoint - a_toolPos;
+    a_context.material = m_parent->m_material.get();
+    a_context.force.zero();
+}
+
+//------------------------------------------------------------------------------
+
+bool FusedEffect::computeForce(const cVector3d& a_toolPos, const cVector3d& a_toolVel,
+                               const unsigned int& a_toolID, cVector3d& a_reactionForce)
+{
+    EffectContext context;
+    beginEvaluation(a_toolPos, a_toolVel, context);
+
+    if (m_effects & VibrationStage::FLAG)   { VibrationStage::apply(context, *this); }
+    if (m_effects & ViscosityStage::FLAG)   { ViscosityStage::apply(context, *this); }
+    if (m_effects & StickSlipStage::FLAG)   { StickSlipStage::apply(context, *this); }
+    if (m_effects & MagnetStage::FLAG)      { MagnetStage::apply(context, *this); }
+
+    a_reactionForce = context.force;
+    return (context.inside || (context.force.lengthsq() > 0.0));
+}
+
+//------------------------------------------------------------------------------
+
+template <int Combination>
+FusedEffect* createEffectKernelOf(cGenericObject* a_parent, SceneArena& a_arena)
+{
+    return (new (a_arena) FusedEffectKernel<typename StagesOf<Combination>::type>(a_parent));
+}
+
+//------------------------------------------------------------------------------
+
+FusedEffect* createEffectKernel(cGenericObject* a_parent, uint32_t a_effects, SceneArena& a_arena)
+{
+    // one kernel is instantiated per combination of effects
+    typedef FusedEffect* (*KernelFactory)(cGenericObject*, SceneArena&);
+    static const KernelFactory factories[NUM_EFFECT_COMBINATIONS] =
+    {
+        createEffectKernelOf<0>,  createEffectKernelOf<1>,  createEffectKernelOf<2>,  createEffectKernelOf<3>,
+        createEffectKernelOf<4>,  createEffectKernelOf<5>,  createEffectKernelOf<6>,  createEffectKernelOf<7>,
+        createEffectKernelOf<8>,  createEffectKernelOf<9>,  createEffectKernelOf<10>, createEffectKernelOf<11>,
+        createEffectKernelOf<12>, createEffectKernelOf<13>, createEffectKernelOf<14>, createEffectKernelOf<15>
+    };
+
+    int combination = ((a_effects & VibrationStage::FLAG) ? 1 : 0) |
+                      ((a_effects & ViscosityStage::FLAG) ? 2 : 0) |
+                      ((a_effects & StickSlipStage::FLAG) ? 4 : 0) |
+                      ((a_effects & MagnetStage::FLAG) ? 8 : 0);
+    return (factories[combination](a_parent, a_arena));
+}
+
+//------------------------------------------------------------------------------
+
+void syncTransforms(void)
+{
+    // only the nodes of moved objects are touched; their global frames follow
+    // from the frame of the world
+    cVector3d worldPos = world->getGlobalPos();
+    cMatrix3d worldRot = world->getGlobalRot();
+    for (unsigned int i = 0; i < transforms.movedIds.size(); i++)
+    {
+        int id = transforms.movedIds[i];
+        cShapeSphere* shape = sceneObjects[id].shape;
+        shape->setLocalPos(transforms.getPos(id));
+        shape->computeGlobalPositions(true, worldPos, worldRot);
+        transforms.moved[id] = 0;
+    }
+    transforms.movedIds.clear();
 }
 
+//------------------------------------------------------------------------------
+
+void beginRealtimeSection(void)
+{
+#ifdef REALTIME_CHECK
+    realtimeSection = true;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+void endRealtimeSection(void)
+{
+#ifdef REALTIME_CHECK
+    realtimeSection = false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+void reportRealtimeViolation(const char* a_what)
+{
+#ifdef REALTIME_CHECK
+    // the report itself may allocate, for instance when backtrace() loads its library
+    realtimeReporting = true;
+    realtimeViolations.fetch_add(1, memory_order_relaxed);
+
+    void* frames[32];
+    int count = backtrace(frames, 32);
+
+    // report each call stack once
+    uint64_t hash = 1469598103934665603ull;
+    for (int i = 0; i < count; i++)
+    {
+        hash = (hash ^ (uint64_t)(uintptr_t)frames[i]) * 1099511628211ull;
+    }
+    bool known = false;
+    for (int i = 0; i < MAX_REALTIME_SITES; i++)
+    {
+        uint64_t site = realtimeSites[i].load(memory_order_relaxed);
+        if ((site == 0) && realtimeSites[i].compare_exchange_strong(site, hash)) { break; }
+        if (site == hash)
+        {
+            known = true;
+            break;
+        }
+    }
+
+    // write() and backtrace_symbols_fd() do not allocate
+    if (!known)
+    {
+        char header[96];
+        int length = snprintf(header, sizeof(header), "realtime check: %s during a haptic tick\n", a_what);
+        if (write(STDERR_FILENO, header, length) == length)
+        {
+            backtrace_symbols_fd(frames + 1, count - 1, STDERR_FILENO);
+        }
+    }
+
+    realtimeReporting = false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+#ifdef REALTIME_CHECK
+
+// the allocation, lock and wait functions below take precedence over those of
+// the C library, which they call through dlsym(RTLD_NEXT); operator new and
+// delete of the C++ library go through malloc(), aligned_alloc() or
+// posix_memalign(), and free()
+
+// storage for the allocations made by dlsym() while the current thread looks up
+// the C library
+char realtimeBootstrap[4096];
+atomic<size_t> realtimeBootstrapUsed(0);
+thread_local bool realtimeResolving = false;
+
+// this function allocates from the bootstrap storage
+void* bootstrapAllocate(size_t a_size)
+{
+    a_size = (a_size + 15) & ~(size_t)15;
+    size_t used = realtimeBootstrapUsed.fetch_add(a_size);
+    if (used + a_size > sizeof(realtimeBootstrap)) { return (NULL); }
+    return (realtimeBootstrap + used);
+}
+
+// this function tells if a block comes from the bootstrap storage
+bool isBootstrapBlock(void* a_ptr)
+{
+    return (((char*)a_ptr >= realtimeBootstrap) && ((char*)a_ptr < realtimeBootstrap + sizeof(realtimeBootstrap)));
+}
+
+// this function looks up a function of the C library on first use; a_version
+// selects a symbol version where dlsym() would return an old compatibility one
+template <class F> F realFunction(atomic<F>& a_function, const char* a_name, const char* a_version = nullptr)
+{
+    F function = a_function.load(memory_order_relaxed);
+    if (function == nullptr)
+    {
+        realtimeResolving = true;
+        if (a_version != nullptr) { function = (F)dlvsym(RTLD_NEXT, a_name, a_version); }
+        if (function == nullptr) { function = (F)dlsym(RTLD_NEXT, a_name); }
+        realtimeResolving = false;
+        a_function.store(function, memory_order_relaxed);
+    }
+    return (function);
+}
+
+extern "C" void* malloc(size_t a_size) noexcept
+{
+    static atomic<void* (*)(size_t)> real(nullptr);
+    if (realtimeResolving) { return (bootstrapAllocate(a_size)); }
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("allocation"); }
+    return (realFunction(real, "malloc")(a_size));
+}
+
+extern "C" void* calloc(size_t a_count, size_t a_size) noexcept
+{
+    static atomic<void* (*)(size_t, size_t)> real(nullptr);
+    if (realtimeResolving) { return (bootstrapAllocate(a_count * a_size)); }
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("allocation"); }
+    return (realFunction(real, "calloc")(a_count, a_size));
+}
+
+extern "C" void* realloc(void* a_ptr, size_t a_size) noexcept
+{
+    static atomic<void* (*)(void*, size_t)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("reallocation"); }
+
+    // a bootstrap block is moved to the C library
+    if ((a_ptr != NULL) && isBootstrapBlock(a_ptr))
+    {
+        void* ptr = malloc(a_size);
+        size_t available = realtimeBootstrap + sizeof(realtimeBootstrap) - (char*)a_ptr;
+        if (ptr != NULL) { memcpy(ptr, a_ptr, (a_size < available) ? a_size : available); }
+        return (ptr);
+    }
+    return (realFunction(real, "realloc")(a_ptr, a_size));
+}
+
+extern "C" int posix_memalign(void** a_ptr, size_t a_alignment, size_t a_size) noexcept
+{
+    static atomic<int (*)(void**, size_t, size_t)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("allocation"); }
+    return (realFunction(real, "posix_memalign")(a_ptr, a_alignment, a_size));
+}
+
+extern "C" void* aligned_alloc(size_t a_alignment, size_t a_size) noexcept
+{
+    static atomic<void* (*)(size_t, size_t)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("allocation"); }
+    return (realFunction(real, "aligned_alloc")(a_alignment, a_size));
+}
+
+extern "C" void* memalign(size_t a_alignment, size_t a_size) noexcept
+{
+    static atomic<void* (*)(size_t, size_t)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("allocation"); }
+    return (realFunction(real, "memalign")(a_alignment, a_size));
+}
+
+extern "C" void* valloc(size_t a_size) noexcept
+{
+    static atomic<void* (*)(size_t)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("allocation"); }
+    return (realFunction(real, "valloc")(a_size));
+}
+
+extern "C" void free(void* a_ptr) noexcept
+{
+    static atomic<void (*)(void*)> real(nullptr);
+    if ((a_ptr == NULL) || isBootstrapBlock(a_ptr)) { return; }
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("deallocation"); }
+    realFunction(real, "free")(a_ptr);
+}
+
+extern "C" int pthread_mutex_lock(pthread_mutex_t* a_mutex) noexcept
+{
+    static atomic<int (*)(pthread_mutex_t*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("mutex acquisition"); }
+    return (realFunction(real, "pthread_mutex_lock")(a_mutex));
+}
+
+// a failed try-lock does not block, but a successful one still shares the lock
+// with threads that may hold it for a long time
+extern "C" int pthread_mutex_trylock(pthread_mutex_t* a_mutex) noexcept
+{
+    static atomic<int (*)(pthread_mutex_t*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("mutex try-lock"); }
+    return (realFunction(real, "pthread_mutex_trylock")(a_mutex));
+}
+
+extern "C" int pthread_mutex_timedlock(pthread_mutex_t* a_mutex, const struct timespec* a_timeout) noexcept
+{
+    static atomic<int (*)(pthread_mutex_t*, const struct timespec*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("mutex acquisition"); }
+    return (realFunction(real, "pthread_mutex_timedlock")(a_mutex, a_timeout));
+}
+
+extern "C" int pthread_rwlock_rdlock(pthread_rwlock_t* a_lock) noexcept
+{
+    static atomic<int (*)(pthread_rwlock_t*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("read lock acquisition"); }
+    return (realFunction(real, "pthread_rwlock_rdlock")(a_lock));
+}
+
+extern "C" int pthread_rwlock_tryrdlock(pthread_rwlock_t* a_lock) noexcept
+{
+    static atomic<int (*)(pthread_rwlock_t*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("read lock try-lock"); }
+    return (realFunction(real, "pthread_rwlock_tryrdlock")(a_lock));
+}
+
+extern "C" int pthread_rwlock_timedrdlock(pthread_rwlock_t* a_lock, const struct timespec* a_timeout) noexcept
+{
+    static atomic<int (*)(pthread_rwlock_t*, const struct timespec*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("read lock acquisition"); }
+    return (realFunction(real, "pthread_rwlock_timedrdlock")(a_lock, a_timeout));
+}
+
+extern "C" int pthread_rwlock_wrlock(pthread_rwlock_t* a_lock) noexcept
+{
+    static atomic<int (*)(pthread_rwlock_t*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("write lock acquisition"); }
+    return (realFunction(real, "pthread_rwlock_wrlock")(a_lock));
+}
+
+extern "C" int pthread_rwlock_trywrlock(pthread_rwlock_t* a_lock) noexcept
+{
+    static atomic<int (*)(pthread_rwlock_t*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("write lock try-lock"); }
+    return (realFunction(real, "pthread_rwlock_trywrlock")(a_lock));
+}
+
+extern "C" int pthread_rwlock_timedwrlock(pthread_rwlock_t* a_lock, const struct timespec* a_timeout) noexcept
+{
+    static atomic<int (*)(pthread_rwlock_t*, const struct timespec*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("write lock acquisition"); }
+    return (realFunction(real, "pthread_rwlock_timedwrlock")(a_lock, a_timeout));
+}
+
+// condition variables exist in two versions on x86-64 Linux; dlsym() returns the
+// old one, which does not work with condition variables initialized by this program
+extern "C" int pthread_cond_wait(pthread_cond_t* a_condition, pthread_mutex_t* a_mutex)
+{
+    static atomic<int (*)(pthread_cond_t*, pthread_mutex_t*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("condition wait"); }
+    return (realFunction(real, "pthread_cond_wait", "GLIBC_2.3.2")(a_condition, a_mutex));
+}
+
+extern "C" int pthread_cond_timedwait(pthread_cond_t* a_condition, pthread_mutex_t* a_mutex, const struct timespec* a_timeout)
+{
+    static atomic<int (*)(pthread_cond_t*, pthread_mutex_t*, const struct timespec*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("condition wait"); }
+    return (realFunction(real, "pthread_cond_timedwait", "GLIBC_2.3.2")(a_condition, a_mutex, a_timeout));
+}
+
+extern "C" int sem_wait(sem_t* a_semaphore)
+{
+    static atomic<int (*)(sem_t*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("semaphore wait"); }
+    return (realFunction(real, "sem_wait")(a_semaphore));
+}
+
+extern "C" int sem_timedwait(sem_t* a_semaphore, const struct timespec* a_timeout)
+{
+    static atomic<int (*)(sem_t*, const struct timespec*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("semaphore wait"); }
+    return (realFunction(real, "sem_timedwait")(a_semaphore, a_timeout));
+}
+
+// waits on an explicit clock (glibc 2.30 and later), used by the timed waits of the C++ library
+#if (__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 30))
+extern "C" int pthread_mutex_clocklock(pthread_mutex_t* a_mutex, clockid_t a_clock, const struct timespec* a_timeout) noexcept
+{
+    static atomic<int (*)(pthread_mutex_t*, clockid_t, const struct timespec*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("mutex acquisition"); }
+    return (realFunction(real, "pthread_mutex_clocklock")(a_mutex, a_clock, a_timeout));
+}
+
+extern "C" int pthread_rwlock_clockrdlock(pthread_rwlock_t* a_lock, clockid_t a_clock, const struct timespec* a_timeout) noexcept
+{
+    static atomic<int (*)(pthread_rwlock_t*, clockid_t, const struct timespec*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("read lock acquisition"); }
+    return (realFunction(real, "pthread_rwlock_clockrdlock")(a_lock, a_clock, a_timeout));
+}
+
+extern "C" int pthread_rwlock_clockwrlock(pthread_rwlock_t* a_lock, clockid_t a_clock, const struct timespec* a_timeout) noexcept
+{
+    static atomic<int (*)(pthread_rwlock_t*, clockid_t, const struct timespec*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("write lock acquisition"); }
+    return (realFunction(real, "pthread_rwlock_clockwrlock")(a_lock, a_clock, a_timeout));
+}
 
+extern "C" int pthread_cond_clockwait(pthread_cond_t* a_condition, pthread_mutex_t* a_mutex, clockid_t a_clock,
+                                      const struct timespec* a_timeout)
+{
+    static atomic<int (*)(pthread_cond_t*, pthread_mutex_t*, clockid_t, const struct timespec*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("condition wait"); }
+    return (realFunction(real, "pthread_cond_clockwait")(a_condition, a_mutex, a_clock, a_timeout));
+}
 
+extern "C" int sem_clockwait(sem_t* a_semaphore, clockid_t a_clock, const struct timespec* a_timeout)
+{
+    static atomic<int (*)(sem_t*, clockid_t, const struct timespec*)> real(nullptr);
+    if (realtimeSection && !realtimeReporting) { reportRealtimeViolation("semaphore wait"); }
+    return (realFunction(real, "sem_clockwait")(a_semaphore, a_clock, a_timeout));
+}
+#endif
 
+#endif
 
 //------------------------------------------------------------------------------
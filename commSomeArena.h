@@ -0,0 +1,149 @@
+//==============================================================================
+/*
+    Arena allocation of scene nodes, materials and effects.
+
+    Scene construction allocates many small objects that live until the
+    application exits. A SceneArena hands them out from large contiguous
+    chunks, in allocation order, so that objects created together (a sphere,
+    its material and its effects) are also close in memory. Individual
+    deletes are no-ops: CHAI3D still runs the destructors when the world is
+    deleted, and release() then frees all chunks at once.
+
+    Example:
+
+        SceneArena arena;
+        cShapeSphere* sphere = new (arena) ArenaNode<cShapeSphere>(0.1);
+        sphere->m_material = std::allocate_shared<cMaterial>(ArenaAllocator<cMaterial>(arena));
+        world->addChild(sphere);
+        ...
+        delete world;       // destroys the sphere; its memory stays in the arena
+        arena.release();    // frees the memory of all objects of the arena
+*/
+//==============================================================================
+
+//------------------------------------------------------------------------------
+#ifndef COMMSOME_ARENA_H
+#define COMMSOME_ARENA_H
+//------------------------------------------------------------------------------
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+//------------------------------------------------------------------------------
+
+// size of the chunks of an arena [bytes]
+const size_t ARENA_CHUNK_SIZE = 64 * 1024;
+
+// alignment of the objects of an arena
+const size_t ARENA_ALIGNMENT = alignof(std::max_align_t);
+
+//------------------------------------------------------------------------------
+
+// a bump allocator; it is not thread-safe, and is meant to be used by the thread
+// that builds the scene
+class SceneArena
+{
+public:
+    SceneArena() : m_current(nullptr), m_used(0), m_capacity(0), m_allocated(0) {}
+    ~SceneArena() { release(); }
+
+    // allocate a block; blocks larger than a chunk get a chunk of their own
+    void* allocate(size_t a_size)
+    {
+        a_size = (a_size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+        if (m_used + a_size > m_capacity)
+        {
+            size_t capacity = (a_size > ARENA_CHUNK_SIZE) ? a_size : ARENA_CHUNK_SIZE;
+            char* chunk = (char*)malloc(capacity);
+            if (chunk == nullptr) { throw std::bad_alloc(); }
+            m_chunks.push_back(chunk);
+
+            // an oversized block does not replace the current chunk
+            if (capacity > ARENA_CHUNK_SIZE)
+            {
+                m_allocated += a_size;
+                return (chunk);
+            }
+            m_current = chunk;
+            m_used = 0;
+            m_capacity = capacity;
+        }
+        void* block = m_current + m_used;
+        m_used += a_size;
+        m_allocated += a_size;
+        return (block);
+    }
+
+    // free all blocks at once; the objects must have been destroyed
+    void release()
+    {
+        for (size_t i = 0; i < m_chunks.size(); i++)
+        {
+            free(m_chunks[i]);
+        }
+        m_chunks.clear();
+        m_current = nullptr;
+        m_used = 0;
+        m_capacity = 0;
+        m_allocated = 0;
+    }
+
+    // number of bytes allocated since the last release
+    size_t getAllocatedSize() const { return (m_allocated); }
+
+    // number of chunks
+    size_t getNumChunks() const { return (m_chunks.size()); }
+
+private:
+    SceneArena(const SceneArena&);
+    SceneArena& operator=(const SceneArena&);
+
+    std::vector<char*> m_chunks;
+    char* m_current;
+    size_t m_used;
+    size_t m_capacity;
+    size_t m_allocated;
+};
+
+//------------------------------------------------------------------------------
+
+// a standard allocator drawing from an arena, for std::allocate_shared
+template <class T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    explicit ArenaAllocator(SceneArena& a_arena) : m_arena(&a_arena) {}
+    template <class U> ArenaAllocator(const ArenaAllocator<U>& a_other) : m_arena(a_other.m_arena) {}
+
+    T* allocate(size_t a_count) { return ((T*)m_arena->allocate(a_count * sizeof(T))); }
+    void deallocate(T*, size_t) {}
+
+    template <class U> bool operator==(const ArenaAllocator<U>& a_other) const { return (m_arena == a_other.m_arena); }
+    template <class U> bool operator!=(const ArenaAllocator<U>& a_other) const { return (m_arena != a_other.m_arena); }
+
+    SceneArena* m_arena;
+};
+
+//------------------------------------------------------------------------------
+
+// a node allocated in an arena; it is created with new (arena) ArenaNode<T>(...)
+// and can be deleted through a pointer to T, which only runs its destructors
+template <class T>
+class ArenaNode : public T
+{
+public:
+    using T::T;
+
+    static void* operator new(size_t a_size, SceneArena& a_arena) { return (a_arena.allocate(a_size)); }
+    static void operator delete(void*, SceneArena&) {}
+    static void operator delete(void*) {}
+
+private:
+    static void* operator new(size_t a_size);
+};
+
+//------------------------------------------------------------------------------
+#endif
+//------------------------------------------------------------------------------
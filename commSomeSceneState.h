@@ -0,0 +1,352 @@
+//==============================================================================
+/*
+    Scene state shared by a commSome haptic server with viewer processes.
+
+    The server (started with --share-state) publishes the poses of the moving
+    objects at every haptic tick into a table of sequence-locked slots, and
+    broadcasts scene events (contacts, parameter reloads, remote station
+    connections) into a ring. Viewers (--viewer, or any other process using
+    SceneStateReader) map the buffer read-only: they never write to it, so a
+    viewer that crashes or stalls cannot affect the server.
+
+    Reader example:
+
+        SceneStateReader reader;
+        if (reader.open())
+        {
+            SharedPose pose;
+            uint64_t count = reader.getPoseCount();
+            if ((count > 0) && reader.readPose(count - 1, pose)) { ... }
+
+            SceneEvent events[64];
+            int n = reader.readEvents(events, 64);
+        }
+*/
+//==============================================================================
+
+//------------------------------------------------------------------------------
+#ifndef COMMSOME_SCENE_STATE_H
+#define COMMSOME_SCENE_STATE_H
+//------------------------------------------------------------------------------
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+//------------------------------------------------------------------------------
+
+// name of the shared memory object
+#define SCENE_STATE_SHM_NAME "/commsome-scene"
+
+// identifies an initialized scene state buffer ("CSST")
+const uint32_t SCENE_STATE_MAGIC = 0x54535343;
+
+// version of the scene state buffer layout
+const uint32_t SCENE_STATE_VERSION = 1;
+
+// maximum number of moving objects in a pose
+const uint32_t SCENE_STATE_MAX_OBJECTS = 8;
+
+// number of poses kept in the pose table (a power of two)
+const uint32_t SCENE_STATE_POSES = 64;
+
+// number of events kept in the event ring (a power of two)
+const uint32_t SCENE_STATE_EVENTS = 1024;
+
+//------------------------------------------------------------------------------
+
+// poses of the moving objects at one haptic tick
+struct SharedPose
+{
+    double time;                                    // server clock [s]
+    double toolPos[3];                              // tool position [m]
+    double remoteToolPos[3];                        // remote tool position [m]
+    uint32_t remoteToolActive;                      // 1 if a remote station is connected
+    uint32_t numObjects;                            // number of moving objects
+    double objectPos[SCENE_STATE_MAX_OBJECTS][3];   // positions of the moving objects [m]
+};
+
+// a slot of the pose table, protected by a sequence counter (odd while being written)
+struct alignas(64) SharedPoseSlot
+{
+    std::atomic<uint32_t> sequence;
+    SharedPose pose;
+};
+
+// types of scene events
+enum SceneEventType
+{
+    SCENE_EVENT_CONTACT_BEGIN = 1,      // the tool touches a scene object
+    SCENE_EVENT_CONTACT_END,            // the tool leaves a scene object
+    SCENE_EVENT_PARAMS_RELOADED,        // haptic parameters were reloaded from the scene file
+    SCENE_EVENT_REMOTE_CONNECTED,       // a remote station connected
+    SCENE_EVENT_REMOTE_DISCONNECTED     // the remote station disconnected
+};
+
+// a scene event
+struct SceneEvent
+{
+    double time;        // server clock [s]
+    uint32_t type;      // SceneEventType
+    int32_t object;     // index of the scene object (-1 = none)
+};
+
+//------------------------------------------------------------------------------
+
+// layout of the shared memory object
+struct SceneStateBuffer
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numObjects;
+    uint32_t reserved;
+
+    // names of the moving objects, so that viewers can check they built the same scene
+    char objectNames[SCENE_STATE_MAX_OBJECTS][16];
+
+    // number of poses and events published so far, each on its own cache line
+    alignas(64) std::atomic<uint64_t> poseCount;
+    alignas(64) std::atomic<uint64_t> eventCount;
+
+    // pose n is stored in slot n % SCENE_STATE_POSES, event n at n % SCENE_STATE_EVENTS
+    SharedPoseSlot poses[SCENE_STATE_POSES];
+    alignas(64) SceneEvent events[SCENE_STATE_EVENTS];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "scene state requires lock-free 64-bit atomics");
+
+//------------------------------------------------------------------------------
+
+// publishes the scene state; there must be a single writer
+class SceneStateWriter
+{
+public:
+    SceneStateWriter() : m_buffer(nullptr), m_poseCount(0), m_eventCount(0) {}
+    ~SceneStateWriter() { close(); }
+
+    // create the shared memory object for a scene with the given moving objects
+    bool open(uint32_t a_numObjects, const char* const* a_names, const char* a_name = SCENE_STATE_SHM_NAME)
+    {
+#ifndef _WIN32
+        if (a_numObjects > SCENE_STATE_MAX_OBJECTS) { return (false); }
+        int fd = shm_open(a_name, O_CREAT | O_RDWR, 0644);
+        if (fd < 0) { return (false); }
+        if (ftruncate(fd, sizeof(SceneStateBuffer)) != 0) { ::close(fd); return (false); }
+        void* ptr = mmap(NULL, sizeof(SceneStateBuffer), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED) { return (false); }
+
+        // readers check the magic number last, once the layout is initialized
+        m_buffer = (SceneStateBuffer*)ptr;
+        m_buffer->magic = 0;
+        m_buffer->version = SCENE_STATE_VERSION;
+        m_buffer->numObjects = a_numObjects;
+        memset(m_buffer->objectNames, 0, sizeof(m_buffer->objectNames));
+        for (uint32_t i = 0; i < a_numObjects; i++)
+        {
+            strncpy(m_buffer->objectNames[i], a_names[i], sizeof(m_buffer->objectNames[i]) - 1);
+        }
+        for (uint32_t i = 0; i < SCENE_STATE_POSES; i++)
+        {
+            m_buffer->poses[i].sequence.store(0, std::memory_order_relaxed);
+        }
+        m_buffer->poseCount.store(0, std::memory_order_relaxed);
+        m_buffer->eventCount.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_buffer->magic = SCENE_STATE_MAGIC;
+        m_poseCount = 0;
+        m_eventCount = 0;
+        return (true);
+#else
+        return (false);
+#endif
+    }
+
+    // unmap the shared memory object; readers keep their mapping
+    void close()
+    {
+#ifndef _WIN32
+        if (m_buffer != nullptr)
+        {
+            munmap(m_buffer, sizeof(SceneStateBuffer));
+            m_buffer = nullptr;
+        }
+#endif
+    }
+
+    // remove the name of the shared memory object
+    static void unlink(const char* a_name = SCENE_STATE_SHM_NAME)
+    {
+#ifndef _WIN32
+        shm_unlink(a_name);
+#endif
+    }
+
+    // publish a pose; wait-free
+    inline void publishPose(const SharedPose& a_pose)
+    {
+        if (m_buffer == nullptr) { return; }
+        SharedPoseSlot& slot = m_buffer->poses[m_poseCount % SCENE_STATE_POSES];
+        uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+        slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.pose = a_pose;
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+        m_poseCount++;
+        m_buffer->poseCount.store(m_poseCount, std::memory_order_release);
+    }
+
+    // broadcast an event; wait-free
+    inline void publishEvent(double a_time, uint32_t a_type, int32_t a_object)
+    {
+        if (m_buffer == nullptr) { return; }
+        SceneEvent& event = m_buffer->events[m_eventCount % SCENE_STATE_EVENTS];
+        event.time = a_time;
+        event.type = a_type;
+        event.object = a_object;
+        m_eventCount++;
+        m_buffer->eventCount.store(m_eventCount, std::memory_order_release);
+    }
+
+private:
+    SceneStateBuffer* m_buffer;
+    uint64_t m_poseCount;
+    uint64_t m_eventCount;
+};
+
+//------------------------------------------------------------------------------
+
+// reads the scene state; each reader keeps its own position in the event ring
+class SceneStateReader
+{
+public:
+    SceneStateReader() : m_buffer(nullptr), m_nextEvent(0), m_lostEvents(0) {}
+    ~SceneStateReader() { close(); }
+
+    // map the shared memory object read-only; events are read from the latest one
+    bool open(const char* a_name = SCENE_STATE_SHM_NAME)
+    {
+#ifndef _WIN32
+        int fd = shm_open(a_name, O_RDONLY, 0);
+        if (fd < 0) { return (false); }
+        void* ptr = mmap(NULL, sizeof(SceneStateBuffer), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED) { return (false); }
+
+        m_buffer = (const SceneStateBuffer*)ptr;
+        if ((m_buffer->magic != SCENE_STATE_MAGIC) || (m_buffer->version != SCENE_STATE_VERSION))
+        {
+            close();
+            return (false);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        m_nextEvent = m_buffer->eventCount.load(std::memory_order_acquire);
+        return (true);
+#else
+        return (false);
+#endif
+    }
+
+    // unmap the shared memory object
+    void close()
+    {
+#ifndef _WIN32
+        if (m_buffer != nullptr)
+        {
+            munmap((void*)m_buffer, sizeof(SceneStateBuffer));
+            m_buffer = nullptr;
+        }
+#endif
+    }
+
+    // number of moving objects and their names
+    uint32_t getNumObjects() const { return ((m_buffer != nullptr) ? m_buffer->numObjects : 0); }
+    const char* getObjectName(uint32_t a_index) const { return (m_buffer->objectNames[a_index]); }
+
+    // number of poses published so far
+    uint64_t getPoseCount() const
+    {
+        return ((m_buffer != nullptr) ? m_buffer->poseCount.load(std::memory_order_acquire) : 0);
+    }
+
+    // read pose a_index; fails if the pose was overwritten or is being written
+    bool readPose(uint64_t a_index, SharedPose& a_pose) const
+    {
+        if (m_buffer == nullptr) { return (false); }
+
+        // the writer may be reusing the oldest half of the table
+        uint64_t count = getPoseCount();
+        if ((a_index >= count) || (a_index + SCENE_STATE_POSES / 2 < count)) { return (false); }
+
+        const SharedPoseSlot& slot = m_buffer->poses[a_index % SCENE_STATE_POSES];
+        for (int attempt = 0; attempt < 4; attempt++)
+        {
+            uint32_t before = slot.sequence.load(std::memory_order_acquire);
+            if (before & 1) { continue; }
+            memcpy(&a_pose, &slot.pose, sizeof(SharedPose));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == before) { return (true); }
+        }
+        return (false);
+    }
+
+    // copy up to a_maxCount events broadcast since the previous call; returns the
+    // number of events copied. Events overwritten before they could be read are
+    // skipped and counted by getLostEventCount().
+    int readEvents(SceneEvent* a_events, int a_maxCount)
+    {
+        if (m_buffer == nullptr) { return (0); }
+
+        uint64_t head = m_buffer->eventCount.load(std::memory_order_acquire);
+
+        // the server restarted with a new buffer under the same mapping
+        if (head < m_nextEvent) { m_nextEvent = head; }
+
+        // the writer has lapped this reader
+        if (head - m_nextEvent > SCENE_STATE_EVENTS)
+        {
+            m_lostEvents += head - SCENE_STATE_EVENTS - m_nextEvent;
+            m_nextEvent = head - SCENE_STATE_EVENTS;
+        }
+
+        int count = (int)((head - m_nextEvent < (uint64_t)a_maxCount) ? head - m_nextEvent : a_maxCount);
+        for (int i = 0; i < count; i++)
+        {
+            a_events[i] = m_buffer->events[(m_nextEvent + i) % SCENE_STATE_EVENTS];
+        }
+
+        // discard events that the writer may have overwritten while they were copied
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = m_buffer->eventCount.load(std::memory_order_relaxed);
+        int valid = count;
+        if (after >= SCENE_STATE_EVENTS)
+        {
+            uint64_t oldestSafe = after - SCENE_STATE_EVENTS + 1;
+            if (m_nextEvent < oldestSafe)
+            {
+                int overwritten = (int)((oldestSafe - m_nextEvent < (uint64_t)count) ? oldestSafe - m_nextEvent : count);
+                memmove(a_events, a_events + overwritten, (count - overwritten) * sizeof(SceneEvent));
+                valid = count - overwritten;
+                m_lostEvents += overwritten;
+            }
+        }
+
+        m_nextEvent += count;
+        return (valid);
+    }
+
+    // number of events lost because the reader fell behind
+    uint64_t getLostEventCount() const { return (m_lostEvents); }
+
+private:
+    const SceneStateBuffer* m_buffer;
+    uint64_t m_nextEvent;
+    uint64_t m_lostEvents;
+};
+
+//------------------------------------------------------------------------------
+#endif
+//------------------------------------------------------------------------------
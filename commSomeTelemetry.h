@@ -0,0 +1,266 @@
+//==============================================================================
+/*
+    Haptic telemetry published in POSIX shared memory.
+
+    The haptic thread of commSome writes one TelemetrySample per servo tick
+    into a ring buffer. Any number of monitoring processes can map the ring
+    read-only and sample it at full rate: readers never write to the shared
+    memory, so they cannot slow down or block the haptic thread.
+
+    Reader example:
+
+        TelemetryReader reader;
+        if (reader.open())
+        {
+            TelemetrySample samples[256];
+            while (true)
+            {
+                int count = reader.read(samples, 256);
+                ...
+            }
+        }
+*/
+//==============================================================================
+
+//------------------------------------------------------------------------------
+#ifndef COMMSOME_TELEMETRY_H
+#define COMMSOME_TELEMETRY_H
+//------------------------------------------------------------------------------
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+//------------------------------------------------------------------------------
+
+// name of the shared memory object
+#define TELEMETRY_SHM_NAME "/commsome-telemetry"
+
+// identifies an initialized telemetry buffer ("TLM1")
+const uint32_t TELEMETRY_MAGIC = 0x314d4c54;
+
+// version of the telemetry buffer layout
+const uint32_t TELEMETRY_VERSION = 1;
+
+// number of samples in the ring (a power of two); 8192 samples hold 8 s at 1 kHz
+const uint32_t TELEMETRY_CAPACITY = 8192;
+
+//------------------------------------------------------------------------------
+
+// telemetry of one haptic tick
+struct TelemetrySample
+{
+    double time;            // time of the tick [s]
+    double loopTime;        // time since the previous tick [s]
+    float position[3];      // device position [m]
+    float force[3];         // force sent to the device [N]
+    uint32_t contacts;      // number of active contacts
+    uint32_t tick;          // tick number
+};
+
+//------------------------------------------------------------------------------
+
+// layout of the shared memory object
+struct TelemetryBuffer
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t sampleSize;
+
+    // number of samples written so far, on its own cache line
+    alignas(64) std::atomic<uint64_t> head;
+
+    // ring of samples; sample n is stored at index n % capacity
+    alignas(64) TelemetrySample samples[TELEMETRY_CAPACITY];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "telemetry requires lock-free 64-bit atomics");
+
+//------------------------------------------------------------------------------
+
+// writes telemetry samples; there must be a single writer
+class TelemetryWriter
+{
+public:
+    TelemetryWriter() : m_buffer(nullptr), m_head(0) {}
+    ~TelemetryWriter() { close(); }
+
+    // create the shared memory object
+    bool open(const char* a_name = TELEMETRY_SHM_NAME)
+    {
+#ifndef _WIN32
+        int fd = shm_open(a_name, O_CREAT | O_RDWR, 0644);
+        if (fd < 0) { return (false); }
+        if (ftruncate(fd, sizeof(TelemetryBuffer)) != 0) { ::close(fd); return (false); }
+        void* ptr = mmap(NULL, sizeof(TelemetryBuffer), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED) { return (false); }
+
+        // readers check the magic number last, once the layout is initialized
+        m_buffer = (TelemetryBuffer*)ptr;
+        m_buffer->magic = 0;
+        m_buffer->version = TELEMETRY_VERSION;
+        m_buffer->capacity = TELEMETRY_CAPACITY;
+        m_buffer->sampleSize = sizeof(TelemetrySample);
+        m_buffer->head.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_buffer->magic = TELEMETRY_MAGIC;
+        m_head = 0;
+        return (true);
+#else
+        return (false);
+#endif
+    }
+
+    // unmap the shared memory object; readers keep their mapping
+    void close()
+    {
+#ifndef _WIN32
+        if (m_buffer != nullptr)
+        {
+            munmap(m_buffer, sizeof(TelemetryBuffer));
+            m_buffer = nullptr;
+        }
+#endif
+    }
+
+    // remove the name of the shared memory object; mapped readers are unaffected
+    static void unlink(const char* a_name = TELEMETRY_SHM_NAME)
+    {
+#ifndef _WIN32
+        shm_unlink(a_name);
+#endif
+    }
+
+    // publish a sample; wait-free
+    inline void write(const TelemetrySample& a_sample)
+    {
+        if (m_buffer == nullptr) { return; }
+        m_buffer->samples[m_head & (TELEMETRY_CAPACITY - 1)] = a_sample;
+        m_head++;
+        m_buffer->head.store(m_head, std::memory_order_release);
+    }
+
+private:
+    TelemetryBuffer* m_buffer;
+    uint64_t m_head;
+};
+
+//------------------------------------------------------------------------------
+
+// reads telemetry samples; each reader keeps its own position in the ring
+class TelemetryReader
+{
+public:
+    TelemetryReader() : m_buffer(nullptr), m_next(0), m_lost(0) {}
+    ~TelemetryReader() { close(); }
+
+    // map the shared memory object read-only; reading starts at the latest sample
+    bool open(const char* a_name = TELEMETRY_SHM_NAME)
+    {
+#ifndef _WIN32
+        int fd = shm_open(a_name, O_RDONLY, 0);
+        if (fd < 0) { return (false); }
+        void* ptr = mmap(NULL, sizeof(TelemetryBuffer), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED) { return (false); }
+
+        m_buffer = (const TelemetryBuffer*)ptr;
+        if ((m_buffer->magic != TELEMETRY_MAGIC) || (m_buffer->version != TELEMETRY_VERSION) ||
+            (m_buffer->sampleSize != sizeof(TelemetrySample)))
+        {
+            close();
+            return (false);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        m_next = m_buffer->head.load(std::memory_order_acquire);
+        return (true);
+#else
+        return (false);
+#endif
+    }
+
+    // unmap the shared memory object
+    void close()
+    {
+#ifndef _WIN32
+        if (m_buffer != nullptr)
+        {
+            munmap((void*)m_buffer, sizeof(TelemetryBuffer));
+            m_buffer = nullptr;
+        }
+#endif
+    }
+
+    // copy up to a_maxCount samples written since the previous call; returns the
+    // number of samples copied. Samples overwritten before they could be read
+    // are skipped and counted by getLostCount().
+    int read(TelemetrySample* a_samples, int a_maxCount)
+    {
+        if (m_buffer == nullptr) { return (0); }
+
+        // the server is initializing the buffer again after a restart
+        if (m_buffer->magic != TELEMETRY_MAGIC) { return (0); }
+
+        uint64_t head = m_buffer->head.load(std::memory_order_acquire);
+
+        // the server restarted with a new buffer under the same mapping; the
+        // samples of the previous run are gone, but they were not lost by this reader
+        if (head < m_next) { m_next = head; }
+
+        // the writer has lapped this reader
+        if (head - m_next > TELEMETRY_CAPACITY)
+        {
+            m_lost += head - TELEMETRY_CAPACITY - m_next;
+            m_next = head - TELEMETRY_CAPACITY;
+        }
+
+        int count = (int)((head - m_next < (uint64_t)a_maxCount) ? head - m_next : a_maxCount);
+        for (int i = 0; i < count; i++)
+        {
+            a_samples[i] = m_buffer->samples[(m_next + i) & (TELEMETRY_CAPACITY - 1)];
+        }
+
+        // discard samples that the writer may have overwritten while they were copied
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = m_buffer->head.load(std::memory_order_relaxed);
+        if ((m_buffer->magic != TELEMETRY_MAGIC) || (after < head))
+        {
+            // the server restarted while the samples were copied
+            m_next = after;
+            return (0);
+        }
+        int valid = count;
+        // (the writer may already be filling the slot of sample after - capacity)
+        if (after >= TELEMETRY_CAPACITY)
+        {
+            uint64_t oldestSafe = after - TELEMETRY_CAPACITY + 1;
+            if (m_next < oldestSafe)
+            {
+                int overwritten = (int)((oldestSafe - m_next < (uint64_t)count) ? oldestSafe - m_next : count);
+                memmove(a_samples, a_samples + overwritten, (count - overwritten) * sizeof(TelemetrySample));
+                valid = count - overwritten;
+                m_lost += overwritten;
+            }
+        }
+
+        m_next += count;
+        return (valid);
+    }
+
+    // number of samples lost because the reader fell behind
+    uint64_t getLostCount() const { return (m_lost); }
+
+private:
+    const TelemetryBuffer* m_buffer;
+    uint64_t m_next;
+    uint64_t m_lost;
+};
+
+//------------------------------------------------------------------------------
+#endif
+//------------------------------------------------------------------------------
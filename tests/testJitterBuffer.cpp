@@ -0,0 +1,253 @@
+//==============================================================================
+/*
+    Loopback test of the teleoperation jitter buffer.
+
+    Packets of a remote tool moving along a known trajectory are handed to the
+    jitter buffer with the arrival times of a simulated network, and the buffer
+    is played out at the haptic rate. Each scenario checks the played position
+    against the trajectory and the statistics of the channel:
+
+        - in-order delivery with a constant delay
+        - reordered packets
+        - lost packets
+        - duplicated packets, mixed with losses
+        - underrun: the latest position is held and no wave is repeated
+        - timeout: the stream stops after TELEOP_TIMEOUT and restarts
+        - UDP loopback: packets go through the network thread to a socket of
+          this process and back, with an artificial delay of 30 ms
+
+    Build (see README.md) and run; the test returns 0 on success.
+*/
+//==============================================================================
+
+//------------------------------------------------------------------------------
+#define main commSome_main
+#include "../commSome.cpp"
+#undef main
+//------------------------------------------------------------------------------
+
+// largest accepted position error [m]
+const double TOLERANCE = 1e-4;
+
+// number of failed checks
+int failures = 0;
+
+//------------------------------------------------------------------------------
+
+// position of the remote tool at remote time a_time
+double trajectory(double a_time)
+{
+    return (0.05 * sin(2.0 * C_PI * 2.0 * a_time));
+}
+
+// this function reports a check
+void check(const char* a_scenario, const char* a_what, bool a_passed)
+{
+    printf("%-12s %-46s %s\n", a_scenario, a_what, a_passed ? "ok" : "FAILED");
+    if (!a_passed) { failures++; }
+}
+
+// this function clears the jitter buffer and the statistics of the channel
+void resetChannel(void)
+{
+    TeleopArrival item;
+    while (teleopIncoming.pop(item)) {}
+    teleopJitterCount = 0;
+    teleopLastArrival = -1.0;
+    teleopReceived = teleopLost = teleopLate = teleopUnderruns = teleopDuplicates = 0;
+}
+
+// this function hands packet a_sequence, sent at remote time a_time, to the jitter buffer at local time a_arrival
+void deliver(uint32_t a_sequence, double a_time, double a_arrival)
+{
+    TeleopArrival item;
+    memset(&item, 0, sizeof(item));
+    item.packet.magic = TELEOP_MAGIC;
+    item.packet.sequence = a_sequence;
+    item.packet.time = a_time;
+    item.packet.position[0] = (float)trajectory(a_time);
+    item.packet.wave[0] = 1.0f;
+    item.arrival = a_arrival;
+    teleopIncoming.push(item);
+}
+
+//------------------------------------------------------------------------------
+
+// a simulated network; packets are sent every millisecond from a remote clock that
+// is 100 s ahead, and delivered a_delay later unless the scenario decides otherwise
+struct Scenario
+{
+    const char* name;
+    double delay;
+    int dropEvery;          // drop every n-th packet (0 = none)
+    int duplicateEvery;     // send every n-th packet twice (0 = none)
+    bool swapPairs;         // deliver packets 2k+1 before 2k, after the first pair
+};
+
+// this function plays a scenario for one second and returns the largest position error
+double playScenario(const Scenario& a_scenario, int& a_dropped, int& a_duplicated)
+{
+    const double clockOffset = 100.0;
+    const double period = TELEOP_SEND_PERIOD;
+    const int count = 1000;
+
+    resetChannel();
+    a_dropped = 0;
+    a_duplicated = 0;
+
+    // arrival time of each packet (negative = lost); the jitter buffer tracks the
+    // smallest delay, so the played position lags the trajectory by that delay
+    vector<double> arrivals(count);
+    double minDelay = a_scenario.delay;
+    for (int i = 0; i < count; i++)
+    {
+        arrivals[i] = i * period + a_scenario.delay;
+        if (a_scenario.swapPairs && (i >= 2)) { arrivals[i] += (i % 2 == 0) ? 1.5 * period : -0.5 * period; }
+        minDelay = cMin(minDelay, arrivals[i] - i * period);
+        if ((a_scenario.dropEvery > 0) && (i % a_scenario.dropEvery == 5))
+        {
+            arrivals[i] = -1.0;
+            a_dropped++;
+        }
+    }
+
+    // packets in arrival order
+    vector<pair<double, int> > schedule;
+    for (int i = 0; i < count; i++)
+    {
+        if (arrivals[i] >= 0.0) { schedule.push_back(make_pair(arrivals[i], i)); }
+    }
+    sort(schedule.begin(), schedule.end());
+
+    double maxError = 0.0;
+    size_t next = 0;
+    for (int tick = 0; tick < count + 100; tick++)
+    {
+        double now = tick * period;
+
+        // deliver the packets that arrived since the last tick, in arrival order
+        while ((next < schedule.size()) && (schedule[next].first <= now))
+        {
+            int i = schedule[next++].second;
+            deliver(i, clockOffset + i * period, arrivals[i]);
+            if ((a_scenario.duplicateEvery > 0) && (i % a_scenario.duplicateEvery == 3))
+            {
+                deliver(i, clockOffset + i * period, arrivals[i]);
+                a_duplicated++;
+            }
+        }
+
+        // after the jitter delay has filled the buffer, the played position follows
+        // the trajectory delayed by the network and the jitter buffer
+        TeleopPacket sample;
+        bool active = playoutRemoteTool(now, sample);
+        if (active && (now > a_scenario.delay + teleopJitterDelay + 0.01) && (tick < count))
+        {
+            double expected = trajectory(clockOffset + now - minDelay - teleopJitterDelay);
+            maxError = cMax(maxError, fabs(sample.position[0] - expected));
+        }
+    }
+    return (maxError);
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    teleopJitterDelay = 0.020;
+
+    // delivery scenarios
+    Scenario scenarios[] =
+    {
+        { "in-order",   0.030, 0,  0, false },
+        { "reordered",  0.030, 0,  0, true },
+        { "lost",       0.030, 10, 0, false },
+        { "duplicated", 0.030, 10, 7, false },
+    };
+    for (unsigned int s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++)
+    {
+        int dropped, duplicated;
+        double error = playScenario(scenarios[s], dropped, duplicated);
+        char text[64];
+        snprintf(text, sizeof(text), "position error %.2e m", error);
+        check(scenarios[s].name, text, error < TOLERANCE);
+        snprintf(text, sizeof(text), "%d lost (expected %d)", (int)teleopLost, dropped);
+        check(scenarios[s].name, text, (int)teleopLost == dropped);
+        snprintf(text, sizeof(text), "%d late", (int)teleopLate);
+        check(scenarios[s].name, text, teleopLate == 0);
+        snprintf(text, sizeof(text), "%d duplicated (expected %d)", (int)teleopDuplicates, duplicated);
+        check(scenarios[s].name, text, (int)teleopDuplicates == duplicated);
+    }
+
+    // underrun: the stream stops; the latest position is held without waves
+    resetChannel();
+    for (int i = 0; i < 100; i++) { deliver(i, 100.0 + 0.001 * i, 0.001 * i); }
+    TeleopPacket sample;
+    bool active = playoutRemoteTool(0.2, sample);
+    check("underrun", "active before the timeout", active);
+    check("underrun", "latest position held",
+          active && (fabs(sample.position[0] - trajectory(100.099)) < TOLERANCE));
+    check("underrun", "waves are not repeated", active && (sample.wave[0] == 0.0f));
+    check("underrun", "underrun counted", teleopUnderruns > 0);
+
+    // timeout: no packet for TELEOP_TIMEOUT; a new packet restarts the stream
+    active = playoutRemoteTool(0.099 + TELEOP_TIMEOUT + 0.001, sample);
+    check("timeout", "inactive after the timeout", !active);
+    deliver(5000, 200.0, 1.0);
+    deliver(5001, 200.001, 1.001);
+    active = playoutRemoteTool(1.001 + teleopJitterDelay, sample);
+    check("timeout", "restarted by a new packet", active);
+    check("timeout", "no loss counted across the restart", teleopLost == 0);
+
+    // UDP loopback: the network thread sends the packets to its own port
+    resetChannel();
+    teleopPort = 47631;
+    teleopPeer = "127.0.0.1:47631";
+    teleopDelay = 0.030;
+    teleopRunning = true;
+    teleopFinished = false;
+    simClock.start(true);
+    cThread* thread = new cThread();
+    thread->start(runTeleopNetwork, CTHREAD_PRIORITY_GRAPHICS);
+
+    int sent = 0;
+    double maxError = 0.0;
+    double start = simClock.getCurrentTimeSeconds();
+    while (simClock.getCurrentTimeSeconds() - start < 0.5)
+    {
+        double now = simClock.getCurrentTimeSeconds();
+        TeleopArrival outgoing;
+        memset(&outgoing, 0, sizeof(outgoing));
+        outgoing.packet.magic = TELEOP_MAGIC;
+        outgoing.packet.sequence = sent++;
+        outgoing.packet.time = now;
+        outgoing.packet.position[0] = (float)trajectory(now);
+        outgoing.arrival = now;
+        teleopOutgoing.push(outgoing);
+
+        // once the buffer is filled, the played position is interpolated at its target time
+        if (playoutRemoteTool(now, sample) && (now - start > teleopDelay + teleopJitterDelay + 0.02))
+        {
+            double expected = trajectory(now - teleopOffset - teleopJitterDelay);
+            maxError = cMax(maxError, fabs(sample.position[0] - expected));
+        }
+        cSleepMs(1);
+    }
+    cSleepMs(100);
+    playoutRemoteTool(simClock.getCurrentTimeSeconds(), sample);
+    teleopRunning = false;
+    while (!teleopFinished) { cSleepMs(10); }
+
+    char text[64];
+    snprintf(text, sizeof(text), "%d of %d packets received", (int)teleopReceived, sent);
+    check("udp", text, (int)teleopReceived == sent);
+    snprintf(text, sizeof(text), "%d lost, %d late", (int)teleopLost, (int)teleopLate);
+    check("udp", text, (teleopLost == 0) && (teleopLate == 0));
+    snprintf(text, sizeof(text), "delay estimate %.1f ms", 1000.0 * teleopOffset);
+    check("udp", text, (teleopOffset >= teleopDelay) && (teleopOffset < teleopDelay + 0.01));
+    snprintf(text, sizeof(text), "position error %.2e m", maxError);
+    check("udp", text, maxError < TOLERANCE);
+
+    printf("%s\n", (failures == 0) ? "all checks passed" : "some checks FAILED");
+    return ((failures == 0) ? 0 : 1);
+}
@@ -0,0 +1,71 @@
+//==============================================================================
+/*
+    Radial sweep of the magnetic effect: the fused magnet stage against the
+    stock cEffectMagnet of CHAI3D.
+
+    The tool is moved along the normal of a sphere, outside and inside the
+    surface, for several combinations of stiffness, maximum force and maximum
+    distance. Both effects must return the same force at every position.
+
+    Build (see README.md) and run; the test returns 0 on success.
+*/
+//==============================================================================
+
+//------------------------------------------------------------------------------
+#define main commSome_main
+#include "../commSome.cpp"
+#undef main
+//------------------------------------------------------------------------------
+
+// largest accepted difference between both forces [N]
+const double TOLERANCE = 1e-9;
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    // stiffness [N/m], maximum force [N] and maximum distance [m]; the linear
+    // range of the second and third sets extends beyond half the sweep distance
+    const double sets[][3] = { { 1000.0, 2.0, 0.05 }, { 100.0, 2.0, 0.08 }, { 50.0, 3.0, 0.1 }, { 10.0, 3.0, 0.1 } };
+
+    SceneArena arena;
+    cShapeSphere* sphere = new cShapeSphere(0.1, make_shared<cMaterial>());
+    FusedEffect* fused = new (arena) FusedEffect(sphere, EFFECT_MAGNETIC);
+    cEffectMagnet stock(sphere);
+
+    bool passed = true;
+    for (unsigned int s = 0; s < sizeof(sets) / sizeof(sets[0]); s++)
+    {
+        sphere->m_material->setStiffness(sets[s][0]);
+        sphere->m_material->setMagnetMaxForce(sets[s][1]);
+        sphere->m_material->setMagnetMaxDistance(sets[s][2]);
+
+        double maxError = 0.0;
+        double peak = 0.0;
+        for (int i = -50; i <= 150; i++)
+        {
+            // signed distance of the tool from the surface, negative inside
+            double depth = 1.2 * sets[s][2] * i / 100.0;
+            cVector3d toolPos(0.1 + depth, 0.0, 0.0);
+            sphere->m_interactionPoint.set(0.1, 0.0, 0.0);
+            sphere->m_interactionNormal.set(1.0, 0.0, 0.0);
+            sphere->m_interactionInside = (depth < 0.0);
+
+            cVector3d forceFused(0, 0, 0);
+            cVector3d forceStock(0, 0, 0);
+            unsigned int id = 0;
+            fused->computeForce(toolPos, cVector3d(0, 0, 0), id, forceFused);
+            stock.computeForce(toolPos, cVector3d(0, 0, 0), id, forceStock);
+
+            maxError = cMax(maxError, (forceFused - forceStock).length());
+            peak = cMax(peak, forceFused.length());
+        }
+
+        bool ok = (maxError <= TOLERANCE) && (peak <= sets[s][1] + TOLERANCE);
+        printf("k=%6.1f N/m  max force=%.1f N  max distance=%.2f m: peak %.3f N, max difference %.2e N %s\n",
+               sets[s][0], sets[s][1], sets[s][2], peak, maxError, ok ? "ok" : "FAILED");
+        passed = passed && ok;
+    }
+
+    return (passed ? 0 : 1);
+}
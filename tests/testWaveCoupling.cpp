@@ -0,0 +1,211 @@
+//==============================================================================
+/*
+    Stability test of the wave-variable coupling over a delayed loopback.
+
+    Two stations run in this process, each with a simulated device: a mass held
+    by the hand of the operator through a spring. The hand of station A pushes
+    its tool repeatedly into the tool of station B, whose hand stays still.
+    Packets go through the jitter buffer of the receiving station with a
+    constant network delay of 0, 20, 50, 100 and 200 ms, and each station runs
+    computeWaveCoupling() at 1 kHz like the haptic loop.
+
+    For each delay, the test checks that:
+        - the force applied by the coupling to each tool stays bounded
+        - the energy of the devices (mass and hand spring) stays bounded
+        - the coupling delivers no more energy to the devices than the leak
+          allowed by the drift correction of a free proxy
+
+    Build (see README.md) and run; the test returns 0 on success.
+*/
+//==============================================================================
+
+//------------------------------------------------------------------------------
+#define main commSome_main
+#include "../commSome.cpp"
+#undef main
+//------------------------------------------------------------------------------
+
+// period of the haptic loop [s] and duration of each run [s]
+const double TICK = 0.001;
+const double DURATION = 10.0;
+
+// simulated device: moving mass [kg], hand stiffness [N/m] and hand damping [N.s/m]
+const double DEVICE_MASS = 0.2;
+const double HAND_STIFFNESS = 200.0;
+const double HAND_DAMPING = 1.0;
+
+// bounds checked by the test
+const double MAX_FORCE = 10.0;         // [N]
+const double MAX_ENERGY = 0.5;         // [J]
+const double MAX_GENERATED = 0.05;     // [J]
+
+//------------------------------------------------------------------------------
+
+// the teleoperation state of one station; the globals of commSome.cpp hold the
+// state of a single station, so they are swapped in and out around each tick
+struct Station
+{
+    TeleopArrival jitter[TELEOP_JITTER];
+    int jitterCount;
+    double offset;
+    uint32_t highest;
+    uint32_t played;
+    uint64_t receivedMask;
+    double lastArrival;
+    bool coupled;
+    cVector3d proxyPos;
+    cVector3d waveIn;
+    cVector3d returnIn;
+    uint32_t sequence;
+
+    // packets on their way to this station
+    deque<TeleopArrival> network;
+
+    // simulated device
+    cVector3d pos;
+    cVector3d vel;
+    cVector3d hand;
+};
+
+// this function moves the state of a station into the globals
+void load(Station& a_station)
+{
+    memcpy(teleopJitter, a_station.jitter, sizeof(teleopJitter));
+    teleopJitterCount = a_station.jitterCount;
+    teleopOffset = a_station.offset;
+    teleopHighest = a_station.highest;
+    teleopPlayed = a_station.played;
+    teleopReceivedMask = a_station.receivedMask;
+    teleopLastArrival = a_station.lastArrival;
+    teleopCoupled = a_station.coupled;
+    remoteProxyPos = a_station.proxyPos;
+    teleopWaveIn = a_station.waveIn;
+    teleopReturnIn = a_station.returnIn;
+}
+
+// this function moves the globals into the state of a station
+void store(Station& a_station)
+{
+    memcpy(a_station.jitter, teleopJitter, sizeof(teleopJitter));
+    a_station.jitterCount = teleopJitterCount;
+    a_station.offset = teleopOffset;
+    a_station.highest = teleopHighest;
+    a_station.played = teleopPlayed;
+    a_station.receivedMask = teleopReceivedMask;
+    a_station.lastArrival = teleopLastArrival;
+    a_station.coupled = teleopCoupled;
+    a_station.proxyPos = remoteProxyPos;
+    a_station.waveIn = teleopWaveIn;
+    a_station.returnIn = teleopReturnIn;
+}
+
+// this function runs one haptic tick of a station and returns the coupling force
+cVector3d tick(Station& a_station, Station& a_peer, double a_time, double a_delay)
+{
+    load(a_station);
+
+    // receive the packets whose delay has elapsed
+    while (!a_station.network.empty() && (a_station.network.front().arrival <= a_time))
+    {
+        teleopIncoming.push(a_station.network.front());
+        a_station.network.pop_front();
+    }
+
+    TeleopPacket remote;
+    bool active = playoutRemoteTool(a_time, remote);
+
+    TeleopArrival outgoing;
+    memset(&outgoing, 0, sizeof(outgoing));
+    cVector3d force = computeWaveCoupling(remote, active, a_station.pos, a_station.vel, TICK, outgoing.packet);
+
+    // send the tool to the peer
+    outgoing.packet.magic = TELEOP_MAGIC;
+    outgoing.packet.sequence = a_station.sequence++;
+    outgoing.packet.time = a_time;
+    for (int i = 0; i < 3; i++)
+    {
+        outgoing.packet.position[i] = (float)a_station.pos(i);
+        outgoing.packet.force[i] = (float)force(i);
+    }
+    outgoing.arrival = a_time + a_delay;
+    a_peer.network.push_back(outgoing);
+
+    store(a_station);
+    return (force);
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    // the example couples the tools with half the stiffness of a typical device
+    world = new cWorld();
+    tool = new cToolCursor(world);
+    tool->setRadius(0.03);
+    teleopStiffness = 500.0;
+    teleopImpedance = 4.0;
+    teleopJitterDelay = 0.020;
+
+    const double delays[] = { 0.0, 0.020, 0.050, 0.100, 0.200 };
+    bool passed = true;
+    for (unsigned int d = 0; d < sizeof(delays) / sizeof(delays[0]); d++)
+    {
+        Station* a = new Station();
+        Station* b = new Station();
+        Station* stations[2] = { a, b };
+        for (int s = 0; s < 2; s++)
+        {
+            stations[s]->jitterCount = 0;
+            stations[s]->lastArrival = -1.0;
+            stations[s]->coupled = false;
+            stations[s]->sequence = 0;
+        }
+        b->hand.set(0.07, 0.0, 0.0);
+        b->pos = b->hand;
+
+        double peakForce = 0.0;
+        double peakEnergy = 0.0;
+        double generated = 0.0;
+        double maxGenerated = 0.0;
+        for (int n = 0; n < (int)(DURATION / TICK); n++)
+        {
+            double time = n * TICK;
+
+            // the hand of A pushes 3 cm into B at 1 Hz
+            a->hand.set(0.03 * (1.0 - cos(2.0 * C_PI * time)), 0.0, 0.0);
+
+            cVector3d forces[2];
+            forces[0] = tick(*a, *b, time, delays[d]);
+            forces[1] = tick(*b, *a, time, delays[d]);
+
+            double energy = 0.0;
+            for (int s = 0; s < 2; s++)
+            {
+                Station& station = *stations[s];
+                cVector3d stretch = station.hand - station.pos;
+                cVector3d handForce = HAND_STIFFNESS * stretch - HAND_DAMPING * station.vel;
+
+                // energy delivered by the coupling to the device during this tick
+                generated += forces[s].dot(station.vel) * TICK;
+
+                station.vel += (TICK / DEVICE_MASS) * (handForce + forces[s]);
+                station.pos += TICK * station.vel;
+
+                peakForce = cMax(peakForce, forces[s].length());
+                energy += 0.5 * DEVICE_MASS * station.vel.lengthsq() + 0.5 * HAND_STIFFNESS * stretch.lengthsq();
+            }
+            peakEnergy = cMax(peakEnergy, energy);
+            maxGenerated = cMax(maxGenerated, generated);
+        }
+
+        bool ok = (peakForce < MAX_FORCE) && (peakEnergy < MAX_ENERGY) && (maxGenerated < MAX_GENERATED);
+        printf("delay %3.0f ms: peak force %6.3f N, peak energy %.4f J, energy delivered by the coupling %+.4f J %s\n",
+               1000.0 * delays[d], peakForce, peakEnergy, maxGenerated, ok ? "ok" : "FAILED");
+        passed = passed && ok;
+
+        delete a;
+        delete b;
+    }
+
+    return (passed ? 0 : 1);
+}